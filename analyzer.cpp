@@ -1,115 +1,951 @@
 #include "analyzer.h"
+#include "kernels.h"
+#include "zonecatalog.h"
+#include "civiltime.h"
+#include "groupby.h"
 #include <vector>
 #include <string>
 #include <algorithm>
-#include <iostream>
-#include <unordered_map>
+#include <charconv>
+#include <cmath>
 #include <utility>
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 using namespace std;
 
+// Empty exact state; catalog zones keep their (zero) rows so that zone
+// index == catalog position.
+void TripAnalyzer::resetExact() {
+    zones.setHugePages(hugePages);
+    zoneTotals = HugeVector<long long>(zones.size(), 0, HugePageAllocator<long long>(hugePages));
+    slotCounts.setHugePages(hugePages);
+    for (size_t z = 0; z < zones.size(); ++z) slotCounts.addZone();
+    fareQuantiles.setHugePages(hugePages);
+    distanceQuantiles.setHugePages(hugePages);
+    if (memoryBudget) {
+        // Size everything for the zones the budget allows up front, so the
+        // tables never double past it; a spill comes one batch early.
+        size_t fit = zones.size() + max<size_t>(memoryBudget / kBytesPerZone, 2 * kIngestBatch);
+        zones.reserve(fit);
+        zoneTotals.reserve(fit);
+        slotCounts.reserve(fit);
+        spillAtZones = fit - kIngestBatch;
+    }
+}
+
+void TripAnalyzer::beginIngest() {
+    if (ingestMode == IngestMode::Exact) {
+        spillRuns.clear();
+        runReadFailed = false;
+        resetExact();
+        seenTripIds.clear();
+    }
+    ingestStats = IngestStats();
+}
+
+void TripAnalyzer::finishIngest() {
+    ingestStats.rowsMalformed = ingestStats.rowsRead - ingestStats.rowsAccepted
+                              - ingestStats.duplicatesRejected - ingestStats.unknownZones;
+    if (quarantineSink) quarantineSink->flush();
+}
+
+bool TripAnalyzer::loadZoneCatalog(const string& path, UnknownZonePolicy policy) {
+    auto catalog = make_shared<ZoneCatalog>();
+    if (!catalog->load(path)) return false;
+    zones.setCatalog(std::move(catalog));
+    unknownZonePolicy = policy;
+    spillRuns.clear();
+    resetExact();
+    return true;
+}
+
+void TripAnalyzer::setMemoryBudget(size_t bytes, const string& spillDir) {
+    memoryBudget = bytes;
+    spillDirectory = spillDir;
+    if (spillDirectory.empty()) {
+        const char* tmp = getenv("TMPDIR");
+        spillDirectory = tmp && *tmp ? tmp : "/tmp";
+    }
+}
+
 void TripAnalyzer::ingestFile(const string& csvPath) {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-    zoneMapCount.clear();
-    slotMapCount.clear();
-    zoneMapCount.reserve(10000);
-    slotMapCount.reserve(10000);
-
-    ifstream file(csvPath);
-    string line;
-
-    getline(file, line);
-    while (getline(file, line)){
-        size_t firstComma = line.find(',');
-        if (firstComma == string::npos) continue;
-        size_t secondComma = line.find(',', firstComma + 1);
-        if (secondComma == string::npos) continue;
-        size_t thirdComma = line.find(',', secondComma + 1);
-        if (thirdComma == string::npos) continue;
-        size_t fourthComma = line.find(',', thirdComma + 1);
-        if (fourthComma == string::npos) continue;
-        size_t fifthComma = line.find(',', fourthComma + 1);
-        if (fifthComma == string::npos) continue;
-         
-        string zoneID = line.substr(firstComma + 1, secondComma - firstComma - 1);
-        if (zoneID.empty()) continue;
-        
-        string dateHour = line.substr(thirdComma + 1, fourthComma - thirdComma -1);
-        if (dateHour.size() < 16) continue;
-        string pickUpHourString = dateHour.substr(11, 2);
-        int pickUpHour = (pickUpHourString[0] - '0') * 10 + (pickUpHourString[1] - '0');
-
-        
-         
-        zoneMapCount[zoneID]++;
-        slotMapCount[zoneID][pickUpHour]++;
+    ingestFiles({csvPath});
+}
+
+// Each of the workers gets an equal share of the memory budget.
+TripAnalyzer TripAnalyzer::makeWorker(int workers) const {
+    TripAnalyzer w;
+    w.ingestMode = ingestMode;
+    w.readMode = readMode;
+    w.asyncDepth = asyncDepth;
+    w.asyncBlockBytes = asyncBlockBytes;
+    w.asyncBackend = asyncBackend;
+    w.dedupEnabled = dedupEnabled;
+    w.hugePages = hugePages;
+    w.unknownZonePolicy = unknownZonePolicy;
+    w.quantilesEnabled = quantilesEnabled;
+    w.strictTimestamps = strictTimestamps;
+    w.quarantineSink = quarantineSink;
+    w.currentFile = currentFile;
+    w.columns = columns;
+    w.columnCommas = columnCommas;
+    if (memoryBudget) w.setMemoryBudget(max<size_t>(memoryBudget / workers, 1), spillDirectory);
+    w.zones.setCatalog(zones.catalog());
+    w.resetExact();
+    return w;
+}
+
+void TripAnalyzer::ingestFiles(const vector<string>& csvPaths) {
+    bool prof = profilingEnabled && perf.available();
+    if (prof) perf.start();
+    ingestAll(csvPaths);
+    if (prof) phaseProfile.ingest = perf.stop();
+}
+
+void TripAnalyzer::ingestAll(const vector<string>& csvPaths) {
+    beginIngest();
+    if (checkpointing()) {
+        ingestCheckpointed(csvPaths);
+        finishIngest();
+        return;
+    }
+    int threads = dedupEnabled ? 1 : threadCount;
+
+    if (threads > 1 && csvPaths.size() == 1 && readMode == ReadMode::Mmap) {
+        // One big file: split the mapping into line-aligned ranges.
+        const string& path = csvPaths[0];
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_t size = (size_t)st.st_size;
+            void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, size, MADV_SEQUENTIAL);
+                const char* begin = (const char*)map;
+                const char* end = begin + size;
+                const char* nl = (const char*)memchr(begin, '\n', size);
+                const char* body = nl ? nl + 1 : end;
+                useHeader(string_view(begin, body - begin - (nl ? 1 : 0)));
+
+                vector<const char*> cuts = {body};
+                for (int t = 1; t < threads; ++t) {
+                    const char* c = body + (end - body) * t / threads;
+                    if (c < cuts.back()) c = cuts.back();
+                    const char* n = (const char*)memchr(c, '\n', end - c);
+                    cuts.push_back(n ? n + 1 : end);
+                }
+                cuts.push_back(end);
+
+                if (quarantineSink) currentFile = path;
+                vector<TripAnalyzer> workers(threads, makeWorker(threads));
+                vector<thread> pool;
+                for (int t = 0; t < threads; ++t)
+                    pool.emplace_back([&, t] {
+                        workers[t].rangeBase = begin;
+                        workers[t].ingestRange(cuts[t], cuts[t + 1]);
+                        workers[t].finishIngest();
+                    });
+                for (auto& th : pool) th.join();
+                munmap(map, size);
+                for (const auto& w : workers) merge(w);
+                ingestStats.filesRead = 1;
+                ingestStats.bytesRead = (long long)size;
+            }
+        }
+        if (fd >= 0) close(fd);
+        finishIngest();
+        return;
+    }
+
+    if (threads > 1 && csvPaths.size() > 1) {
+        threads = (int)min<size_t>(threads, csvPaths.size());
+        vector<TripAnalyzer> workers(threads, makeWorker(threads));
+        atomic<size_t> nextFile{0};
+        vector<thread> pool;
+        for (int t = 0; t < threads; ++t)
+            pool.emplace_back([&, t] {
+                for (size_t i; !workers[t].ingestStats.spillFailed && (i = nextFile.fetch_add(1)) < csvPaths.size();)
+                    workers[t].ingestPath(csvPaths[i]);
+                workers[t].finishIngest();
+            });
+        for (auto& th : pool) th.join();
+        for (const auto& w : workers) merge(w);
+        finishIngest();
+        return;
+    }
+
+    for (size_t i = 0; i < csvPaths.size() && !ingestStats.spillFailed; ++i) ingestPath(csvPaths[i]);
+    finishIngest();
+}
+
+// Sequential ingest for setCheckpoint. A checkpoint is resumed only if
+// it names the same input at the same position of the list and the file
+// still has the same bytes up to its offset; otherwise ingest starts over.
+void TripAnalyzer::ingestCheckpointed(const vector<string>& csvPaths) {
+    checkpointWriter = make_shared<CheckpointWriter>(checkpointPath);
+    checkpointGeneration = 0;
+    size_t first = 0;
+    long long resumeAt = 0;
+    IngestCheckpoint cp;
+    uint64_t fingerprint;
+    if (readCheckpoint(checkpointPath, cp) && cp.fileIndex < csvPaths.size() && csvPaths[cp.fileIndex] == cp.path &&
+        cp.counters.size() == 8 && fingerprintFile(cp.path, cp.offset, fingerprint) && fingerprint == cp.fingerprint &&
+        loadSnapshot(CheckpointWriter::statePath(checkpointPath, cp.generation))) {
+        const int64_t* c = cp.counters.data();
+        ingestStats.rowsRead = c[0];
+        ingestStats.rowsAccepted = c[1];
+        ingestStats.duplicatesRejected = c[2];
+        ingestStats.unknownZones = c[3];
+        ingestStats.spillRuns = c[4];
+        ingestStats.rowsQuarantined = c[5];
+        ingestStats.filesRead = c[6];
+        ingestStats.bytesRead = c[7];
+        ingestStats.resumedBytes = c[7] + (long long)cp.offset;
+        first = cp.fileIndex;
+        resumeAt = (long long)cp.offset;
+        currentHeader = cp.header;
+        checkpointGeneration = cp.generation;
+    }
+    for (size_t i = first; i < csvPaths.size() && !ingestStats.stopped; ++i) {
+        checkpointFile = i;
+        ingestPath(csvPaths[i], i == first ? resumeAt : 0);
+    }
+    if (!ingestStats.stopped) checkpointWriter->discard();
+    checkpointWriter.reset();
+    stopRequested->store(false);
+}
+
+// Called at a line boundary with no rows pending. The state is copied
+// here, on the parse thread; fingerprinting, encoding and fsync happen on
+// the writer's.
+bool TripAnalyzer::checkpoint(long long offset) {
+    bool stop = stopRequested->load();
+    if (!stop && !checkpointWriter->idle()) {
+        nextCheckpoint = offset + kCheckpointRetry;
+        return false;
+    }
+    nextCheckpoint = offset + checkpointEvery;
+    IngestCheckpoint cp;
+    cp.generation = checkpointGeneration + 1;
+    cp.fileIndex = checkpointFile;
+    cp.offset = (uint64_t)offset;
+    cp.path = currentFile;
+    cp.header = currentHeader;
+    cp.counters = {ingestStats.rowsRead, ingestStats.rowsAccepted, ingestStats.duplicatesRejected,
+                   ingestStats.unknownZones, ingestStats.spillRuns, ingestStats.rowsQuarantined,
+                   ingestStats.filesRead, fileStartBytes};
+    // Dictionary order; the writer sorts. There are no spill runs: see
+    // checkpointing().
+    vector<ZoneRecord> state;
+    state.reserve(zones.size());
+    for (uint32_t z = 0; z < zones.size(); ++z) {
+        if (zoneTotals[z] == 0) continue;
+        state.emplace_back();
+        state.back().zone.assign(zones.name(z));
+        state.back().total = zoneTotals[z];
+        state.back().hours = slotCounts.row(z);
+    }
+    checkpointWriter->submit(std::move(cp), std::move(state));
+    ++checkpointGeneration;
+    ++ingestStats.checkpointsWritten;
+    if (!stop) return false;
+    checkpointWriter->finish();
+    stopRequested->store(false);
+    ingestStats.stopped = true;
+    return true;
+}
+
+// ingestRange in line-aligned pieces that end where checkpoints fall due;
+// offsets count from base. True if the ingest is to stop.
+bool TripAnalyzer::ingestRangeCheckpointed(const char* base, const char* p, const char* end) {
+    while (p < end) {
+        const char* due = max(p, base + min<long long>(nextCheckpoint, end - base));
+        const char* nl = (const char*)memchr(due, '\n', end - due);
+        const char* cut = nl ? nl + 1 : end;
+        ingestRange(p, cut);
+        p = cut;
+        if (checkpointDue(p - base)) return true;
+    }
+    return false;
+}
+
+// resumeAt > 0 continues a checkpointed ingest at that line boundary,
+// with the header recorded in the checkpoint.
+bool TripAnalyzer::ingestPath(const string& path, long long resumeAt) {
+    if (quarantineSink || checkpointWriter) currentFile = path;
+    fileStartBytes = ingestStats.bytesRead;
+    nextCheckpoint = resumeAt + checkpointEvery;
+    if (resumeAt > 0) useHeader(currentHeader);
+    if (readMode == ReadMode::Getline) {
+        ifstream file(path);
+        if (!file) return false;
+        string line;
+        long long offset = resumeAt;
+        if (resumeAt > 0) {
+            file.seekg(resumeAt);
+        } else {
+            getline(file, line);
+            useHeader(line);
+            offset = (long long)line.size() + !file.eof();
+        }
+        // A last line without a newline ends at end of file, not one past it.
+        while (getline(file, line)) {
+            rangeBase = line.data();
+            rangeOffset = offset;
+            offset += (long long)line.size() + !file.eof();
+            ingestLine(line.data(), line.data() + line.size());
+            if (checkpointDue(offset)) return true;
+        }
+        ingestStats.bytesRead += offset;
+        ++ingestStats.filesRead;
+        return true;
+    }
+
+    if (readMode == ReadMode::Async) return ingestAsync(path, resumeAt);
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    if (readMode == ReadMode::Mmap) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            size_t size = (size_t)st.st_size;
+            void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, size, MADV_SEQUENTIAL);
+                const char* begin = (const char*)map;
+                const char* body = resumeAt > 0 ? begin + min<size_t>(resumeAt, size) : nullptr;
+                const char* nl = body ? nullptr : (const char*)memchr(begin, '\n', size);
+                if (nl) {
+                    useHeader(string_view(begin, nl - begin));
+                    body = nl + 1;
+                }
+                bool stopped = false;
+                if (body) {
+                    rangeBase = begin;
+                    rangeOffset = 0;
+                    if (checkpointWriter) stopped = ingestRangeCheckpointed(begin, body, begin + size);
+                    else ingestRange(body, begin + size);
+                }
+                munmap(map, size);
+                if (stopped) {
+                    close(fd);
+                    return true;
+                }
+                ingestStats.bytesRead += (long long)size;
+            }
+        }
+        close(fd);
+        ++ingestStats.filesRead;
+        return true;
+    }
+
+    // Stream: fixed chunks, the partial last line carried to the next read.
+    const size_t kChunk = 1 << 20;
+    vector<char> buf(kChunk);
+    size_t carry = 0;
+    long long bufOffset = 0;        // file offset of buf[0]
+    bool inHeader = true;
+    if (resumeAt > 0) {
+        if (lseek(fd, resumeAt, SEEK_SET) != resumeAt) {
+            close(fd);
+            return false;
+        }
+        bufOffset = resumeAt;
+        inHeader = false;
+        ingestStats.bytesRead += resumeAt;
+    }
+    bool stopped = false;
+    for (;;) {
+        if (carry == buf.size()) buf.resize(buf.size() * 2);   // line longer than a chunk
+        ssize_t n = read(fd, buf.data() + carry, buf.size() - carry);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        ingestStats.bytesRead += n;
+        const char* p = buf.data();
+        const char* end = p + carry + n;
+        if (inHeader) {
+            const char* nl = (const char*)memchr(p, '\n', end - p);
+            if (!nl) { carry = end - buf.data(); continue; }
+            useHeader(string_view(p, nl - p));
+            p = nl + 1;
+            inHeader = false;
+        }
+        const char* lastNl = (const char*)memrchr(p, '\n', end - p);
+        const char* stop = lastNl ? lastNl + 1 : p;
+        rangeBase = buf.data();
+        rangeOffset = bufOffset;
+        ingestRange(p, stop);
+        carry = end - stop;
+        bufOffset += stop - buf.data();
+        memmove(buf.data(), stop, carry);
+        if (checkpointDue(bufOffset)) {
+            stopped = true;
+            break;
+        }
+    }
+    rangeBase = buf.data();
+    rangeOffset = bufOffset;
+    if (!inHeader && carry > 0 && !stopped) ingestRange(buf.data(), buf.data() + carry);
+    close(fd);
+    if (stopped) return true;
+    ++ingestStats.filesRead;
+    return true;
+}
+
+// Blocks arrive in file order. Rows inside a block are parsed in place;
+// a row cut by a block boundary is stitched together in carry.
+bool TripAnalyzer::ingestAsync(const string& path, long long resumeAt) {
+    AsyncFileReader reader;
+    if (!reader.open(path, (uint64_t)resumeAt, asyncBlockBytes, asyncDepth, asyncBackend)) return false;
+    ingestStats.bytesRead += resumeAt;
+    string carry;
+    long long carryOffset = resumeAt;   // file offset of carry[0]
+    bool inHeader = resumeAt == 0;
+    const char* data;
+    size_t size;
+    bool ok;
+    while ((ok = reader.next(data, size)) && size > 0) {
+        ingestStats.bytesRead += (long long)size;
+        const char* p = data;
+        const char* end = data + size;
+        if (inHeader || !carry.empty()) {
+            const char* nl = (const char*)memchr(p, '\n', size);
+            if (!nl) {
+                carry.append(p, size);
+                continue;
+            }
+            carry.append(p, nl - p);
+            if (inHeader) {
+                useHeader(carry);
+                inHeader = false;
+            } else {
+                rangeBase = carry.data();
+                rangeOffset = carryOffset;
+                ingestRange(carry.data(), carry.data() + carry.size());
+            }
+            carry.clear();
+            p = nl + 1;
+        }
+        const char* lastNl = (const char*)memrchr(p, '\n', end - p);
+        const char* stop = lastNl ? lastNl + 1 : p;
+        rangeBase = data;
+        rangeOffset = (long long)reader.offset();
+        ingestRange(p, stop);
+        carry.assign(stop, end);
+        carryOffset = (long long)reader.offset() + (stop - data);
+        if (checkpointDue(carryOffset)) return true;
+    }
+    if (!inHeader && !carry.empty()) {
+        rangeBase = carry.data();
+        rangeOffset = carryOffset;
+        ingestRange(carry.data(), carry.data() + carry.size());
+    }
+    if (ok) ++ingestStats.filesRead;
+    return ok;
+}
+
+// Picked once per process from cpuid (or TRIP_ISA).
+static const ScanKernels& kKernels = scanKernels();
+
+// Rows in [p, end), newline separated; the last row may lack a newline.
+void TripAnalyzer::ingestRange(const char* p, const char* end) {
+    ParsedRow batch[kIngestBatch];
+    int n = 0;
+    while (p < end && !ingestStats.spillFailed) {
+        const char* e = kKernels.findNewline(p, end);
+        if (parseLine(p, e, batch[n]) && ++n == kIngestBatch) {
+            applyRows(batch, n);
+            n = 0;
+        }
+        p = e + 1;
+    }
+    if (n > 0) applyRows(batch, n);
+}
+
+// Single row whose buffer is about to be reused (getline reader).
+void TripAnalyzer::ingestLine(const char* b, const char* e) {
+    ParsedRow row;
+    if (!ingestStats.spillFailed && parseLine(b, e, row)) applyRows(&row, 1);
+}
+
+// Quoted fields lose their quotes as views into the row; only doubled
+// quotes need a copy, kept in a ring long enough to outlive the batch
+// (zone and trip ID are the only fields a pending row holds on to).
+string_view TripAnalyzer::unquote(string_view field) {
+    string& scratch = quoteScratch[nextQuoteScratch];
+    string_view v = unquoteField(field, scratch);
+    if (v.data() == scratch.data()) nextQuoteScratch = (nextQuoteScratch + 1) % kQuoteScratch;
+    return v;
+}
+
+static float parseValue(const char* b, const char* e) {
+    float v;
+    if (from_chars(b, e, v).ec != errc()) return NAN;
+    return v;
+}
+
+bool TripAnalyzer::setQuarantine(const string& path, long long sampleEvery, long long maxRows) {
+    quarantineSink = QuarantineSink::open(path, sampleEvery, maxRows);
+    return quarantineSink != nullptr;
+}
+
+// Off the hot path: parseLine and applyRows only get here for rows they
+// already turned away.
+bool TripAnalyzer::reject(RejectReason reason, const char* b, const char* e) {
+    if (quarantineSink &&
+        quarantineSink->record(reason, currentFile, rangeOffset + (b - rangeBase), string_view(b, e - b)))
+        ++ingestStats.rowsQuarantined;
+    return false;
+}
+
+// Per-file layout: the standard one keeps the fixed-position split below;
+// a mapped one splits only as far as the right-most column in use.
+void TripAnalyzer::useHeader(string_view header) {
+    columns = ColumnMap::fromHeader(header);
+    unsigned need = ColumnMap::bit(ColumnMap::kPickup) | ColumnMap::bit(ColumnMap::kTime);
+    if (dedupEnabled || ingestMode == IngestMode::Sketch) need |= ColumnMap::bit(ColumnMap::kTrip);
+    if (quantilesEnabled) need |= ColumnMap::bit(ColumnMap::kDistance) | ColumnMap::bit(ColumnMap::kFare);
+    columnCommas = columns.commasFor(need);
+    if (checkpointWriter) currentHeader = string(header);
+}
+
+bool TripAnalyzer::parseLine(const char* b, const char* e, ParsedRow& row) {
+    ++ingestStats.rowsRead;
+    string_view trip, zone, ts, distance, fare;
+    if (columns.standard) {
+        uint32_t comma[5];
+        if (kKernels.findCommas(b, e, comma, 5) < 5) return reject(RejectReason::Columns, b, e);
+        trip = string_view(b, comma[0]);
+        zone = string_view(b + comma[0] + 1, comma[1] - comma[0] - 1);
+        ts = string_view(b + comma[2] + 1, comma[3] - comma[2] - 1);
+        distance = string_view(b + comma[3] + 1, comma[4] - comma[3] - 1);
+        fare = string_view(b + comma[4] + 1, e - b - comma[4] - 1);   // trimmed below if used
+    } else {
+        if (!mappedRow.split(b, e, columnCommas)) return reject(RejectReason::Columns, b, e);
+        if (dedupEnabled || ingestMode == IngestMode::Sketch) trip = mappedRow[columns.index[ColumnMap::kTrip]];
+        zone = mappedRow[columns.index[ColumnMap::kPickup]];
+        ts = mappedRow[columns.index[ColumnMap::kTime]];
+        if (quantilesEnabled) {
+            distance = mappedRow[columns.index[ColumnMap::kDistance]];
+            fare = mappedRow[columns.index[ColumnMap::kFare]];
+        }
+    }
+
+    string_view zoneID = unquote(zone);
+    if (zoneID.empty()) return reject(RejectReason::EmptyZone, b, e);
+
+    string scratch;       // fields consumed right here
+    string_view dateHour = unquoteField(ts, scratch);
+    if (dateHour.size() < 16) return reject(RejectReason::BadTime, b, e);
+    int pickUpHour;
+    if (strictTimestamps) {
+        CivilTime t;
+        if (!validTimestamp(dateHour, t)) return reject(RejectReason::BadTime, b, e);
+        pickUpHour = t.hour;
+    } else {
+        pickUpHour = kKernels.parseHour(dateHour.data());
+        if (pickUpHour < 0) return reject(RejectReason::BadTime, b, e);
     }
+
+    row.zone = zoneID;
+    row.tripId = unquote(trip);
+    row.hour = pickUpHour;
+    row.line = b;
+    row.lineLength = (uint32_t)(e - b);
+    if (ingestMode == IngestMode::Exact) row.key = zones.probe(zoneID);
+    if (quantilesEnabled) {
+        uint32_t fareEnd;
+        if (kKernels.findCommas(fare.data(), fare.data() + fare.size(), &fareEnd, 1) == 1) fare = fare.substr(0, fareEnd);
+        distance = unquoteField(distance, scratch);
+        row.distance = parseValue(distance.data(), distance.data() + distance.size());
+        fare = unquoteField(fare, scratch);
+        row.fare = parseValue(fare.data(), fare.data() + fare.size());
+    }
+    if (zones.catalog() && unknownZonePolicy == UnknownZonePolicy::Reject) {
+        bool known = ingestMode == IngestMode::Exact ? ZoneTable::isCatalogKey(row.key)
+                                                     : zones.catalog()->find(zoneID) != ZoneCatalog::kNone;
+        if (!known) {
+            ++ingestStats.unknownZones;
+            return reject(RejectReason::UnknownZone, b, e);
+        }
+    }
+    return true;
 }
 
+// Rows are applied in input order, so dedup and sketch results do not
+// depend on the batch size.
+void TripAnalyzer::applyRows(const ParsedRow* rows, int n) {
+    bool sketchMode = ingestMode == IngestMode::Sketch;
+    const ParsedRow* live[kIngestBatch];
+    uint32_t index[kIngestBatch];
+    int m = 0;
+    for (int i = 0; i < n; ++i) {
+        const ParsedRow& r = rows[i];
+        if (dedupEnabled && !seenTripIds.insert(r.tripId)) {
+            ++ingestStats.duplicatesRejected;
+            reject(RejectReason::Duplicate, r.line, r.line + r.lineLength);
+            continue;
+        }
+        ++ingestStats.rowsAccepted;
+        if (sketchMode) tripSketch.add(r.zone, r.hour, r.tripId);
+        else live[m++] = &r;
+    }
+
+    for (int i = 0; i < m; ++i) {
+        uint32_t z = zones.findOrInsert(live[i]->zone, live[i]->key);
+        if (z == zoneTotals.size()) {
+            zoneTotals.push_back(0);
+            slotCounts.addZone();
+        }
+        index[i] = z;
+        __builtin_prefetch(&zoneTotals[z], 1);
+        slotCounts.prefetch(z, live[i]->hour);
+    }
+    for (int i = 0; i < m; ++i) {
+        zoneTotals[index[i]]++;
+        slotCounts.increment(index[i], live[i]->hour);
+    }
+    if (quantilesEnabled) {
+        for (int i = 0; i < m; ++i) {
+            uint32_t base = index[i] * kQuantileSlots;
+            for (uint32_t id : {base + 24, base + (uint32_t)live[i]->hour}) {
+                fareQuantiles.add(id, live[i]->fare);
+                distanceQuantiles.add(id, live[i]->distance);
+            }
+        }
+    }
+    if (memoryBudget && (zones.size() > spillAtZones || exactBytes() > memoryBudget)) spill();
+}
+
+size_t TripAnalyzer::exactBytes() const {
+    return zones.bytes() + zoneTotals.capacity() * sizeof(long long) + slotCounts.bytes();
+}
+
+// Indices of zones with trips, in zone order (snapshot and run order).
+vector<uint32_t> TripAnalyzer::sortedZones() const {
+    vector<uint32_t> order;
+    for (uint32_t z = 0; z < zones.size(); ++z)
+        if (zoneTotals[z] > 0) order.push_back(z);
+    sort(order.begin(), order.end(),
+         [this](uint32_t a, uint32_t b) { return zones.name(a) < zones.name(b); });
+    return order;
+}
+
+void TripAnalyzer::spill() {
+    if (zones.size() == zones.catalogZones() || quantilesEnabled) return;
+    auto run = ScratchSnapshot::create(spillDirectory);
+    SnapshotWriter writer;
+    bool ok = run && writer.open(run->path());
+    if (ok) {
+        ZoneRecord rec;
+        for (uint32_t z : sortedZones()) {
+            rec.zone.assign(zones.name(z));
+            rec.total = zoneTotals[z];
+            rec.hours = slotCounts.row(z);
+            writer.write(rec);
+        }
+        ok = writer.close();
+    }
+    if (!ok) {
+        // Lifting the budget would trade a clean error for the OOM killer.
+        ingestStats.spillFailed = true;
+        return;
+    }
+    spillRuns.push_back(std::move(run));
+    ++ingestStats.spillRuns;
+    resetExact();
+    compactRuns();
+}
+
+void TripAnalyzer::compactRuns() {
+    if (spillRuns.size() < kSpillFanIn) return;
+    auto run = ScratchSnapshot::create(spillDirectory);
+    vector<string> inputs;
+    for (const auto& r : spillRuns) inputs.push_back(r->path());
+    if (!run || !mergeSnapshotFiles(inputs, run->path())) {
+        ingestStats.spillFailed = true;
+        return;
+    }
+    spillRuns.assign(1, std::move(run));
+}
+
+// Streams the spilled runs and the in-memory state as one zone-sorted
+// sequence, one summed record per zone. False, after a partial stream, if
+// a run is missing or damaged.
+bool TripAnalyzer::forEachMergedZone(const function<void(const ZoneRecord&)>& sink) const {
+    vector<SnapshotReader> readers(spillRuns.size());
+    vector<RecordSource> sources;
+    for (size_t i = 0; i < spillRuns.size(); ++i) {
+        if (!readers[i].open(spillRuns[i]->path())) {
+            runReadFailed = true;
+            return false;
+        }
+        SnapshotReader& r = readers[i];
+        sources.push_back([&r](ZoneRecord& rec) { return r.next(rec); });
+    }
+    vector<uint32_t> order = sortedZones();
+    size_t next = 0;
+    sources.push_back([&](ZoneRecord& rec) {
+        if (next == order.size()) return false;
+        uint32_t z = order[next++];
+        rec.zone.assign(zones.name(z));
+        rec.total = zoneTotals[z];
+        rec.hours = slotCounts.row(z);
+        return true;
+    });
+    mergeZoneStreams(sources, sink);
+    bool ok = true;
+    for (const auto& r : readers)
+        if (r.failed()) ok = false;
+    if (!ok) runReadFailed = true;
+    return ok;
+}
+
+// The built-ins are GroupBy Count questions answered from the dense
+// tables: zone index z is the PickupZone field, so their groups are
+// gathered without lookups and ranked by GroupBy::selectTop.
+template <class KeySpec>
+struct CountQuery {
+    using Groups = GroupBy<KeySpec, Count>;
+    using Group = typename Groups::Group;
+    using Key = typename Groups::Key;
+    static constexpr int kZoneShift = KeySpec::offset(0);
+
+    static Group group(uint32_t zone, int hour, long long count) {
+        TripRow r;
+        r.pickup = zone;
+        r.hour = hour;
+        return {KeySpec::pack(r), {count}};
+    }
+    static uint32_t zone(const Group& g) { return (uint32_t)Groups::template field<0>(g.key); }
+    static void setZone(Group& g, uint32_t zone) {
+        g.key = (g.key & ((Key(1) << kZoneShift) - 1)) | Key(zone) << kZoneShift;
+    }
+};
+
+// Bounded top k of a zone-sorted stream (the spill merge), in a heap whose
+// front is the worst candidate. Candidates are named in a scratch table,
+// rebuilt when evictions leave it mostly stale. A newcomer never wins a
+// tie: every name already kept sorts before it.
+template <class KeySpec>
+class StreamTop {
+public:
+    using Q = CountQuery<KeySpec>;
+    StreamTop(int k, vector<typename Q::Group>& heap, ZoneTable& names)
+        : k((size_t)max(k, 0)), heap(heap), names(names) {}
+
+    void offer(string_view zone, int hour, long long count) {
+        if (heap.size() == k && (k == 0 || count <= get<0>(heap.front().values))) return;
+        if (names.size() > 2 * k + 64) renumber();
+        auto before = Q::Groups::before(names);
+        auto g = Q::group(names.findOrInsert(zone), hour, count);
+        if (heap.size() < k) {
+            heap.push_back(g);
+            push_heap(heap.begin(), heap.end(), before);
+        } else {
+            pop_heap(heap.begin(), heap.end(), before);
+            heap.back() = g;
+            push_heap(heap.begin(), heap.end(), before);
+        }
+    }
+
+private:
+    void renumber() {
+        ZoneTable kept;
+        for (auto& g : heap) Q::setZone(g, kept.findOrInsert(names.name(Q::zone(g))));
+        names = std::move(kept);
+    }
+    size_t k;
+    vector<typename Q::Group>& heap;
+    ZoneTable& names;
+};
+
 std::vector<ZoneCount> TripAnalyzer::topZones(int k) const {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
+    using Q = CountQuery<Keys<PickupZone>>;
+    bool prof = profilingEnabled && perf.available();
+    if (prof) perf.start();
+    vector<Q::Group> groups;
+    ZoneTable candidates;                 // names of sketch or spilled candidates
+    const ZoneTable* names = &zones;
+    if (ingestMode == IngestMode::Sketch) {
+        names = &candidates;
+        for (const auto& e : tripSketch.zoneCandidates().entries())
+            groups.push_back(Q::group(candidates.findOrInsert(e.zone), 0, (long long)e.count));
+    } else if (!spillRuns.empty()) {
+        names = &candidates;
+        StreamTop<Keys<PickupZone>> best(k, groups, candidates);
+        bool ok = forEachMergedZone([&best](const ZoneRecord& rec) { best.offer(rec.zone, 0, rec.total); });
+        if (!ok) groups.clear();
+    } else {
+        groups.reserve(zones.size());
+        for (uint32_t z = 0; z < zones.size(); ++z)
+            if (zoneTotals[z] > 0) groups.push_back(Q::group(z, 0, zoneTotals[z]));
+    }
+    if (groups.empty() || k <= 0) {
+        if (prof) perf.stop();
+        return {};
+    }
+    Q::Groups::selectTop(groups, k, *names, [&] {
+        if (prof) {
+            phaseProfile.select = perf.stop();
+            perf.start();
+        }
+    });
+    if (prof) phaseProfile.sort = perf.stop();
     vector<ZoneCount> result;
-    result.reserve(zoneMapCount.size());
-    for (const auto& entry : zoneMapCount) {
-        result.push_back({entry.first, entry.second});
-    }
-    if (result.empty() || k <= 0) return {};
-    int kk = std::min(k, (int)result.size());
-    nth_element(result.begin(), result.begin() + kk, result.end(),
-        [](const ZoneCount& a, const ZoneCount& b) {
-            if (a.count != b.count)
-                return a.count > b.count; 
-            return a.zone < b.zone;     
-        });
-    sort(result.begin(), result.begin() + kk,
-        [](const ZoneCount& a, const ZoneCount& b) {
-            if (a.count != b.count)
-                return a.count > b.count; 
-            return a.zone < b.zone;     
-        });
-    result.resize(kk);
+    result.reserve(groups.size());
+    for (const auto& g : groups) result.push_back({string(names->name(Q::zone(g))), get<0>(g.values)});
     return result;
 }
 
 
 std::vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
+    using Q = CountQuery<Keys<PickupZone, Hour>>;
+    bool prof = profilingEnabled && perf.available();
+    if (prof) perf.start();
+    vector<Q::Group> groups;
+    ZoneTable candidates;
+    const ZoneTable* names = &zones;
+
+    if (ingestMode == IngestMode::Sketch) {
+        names = &candidates;
+        for (const auto& e : tripSketch.slotCandidates().entries())
+            groups.push_back(Q::group(candidates.findOrInsert(e.zone), e.hour, (long long)e.count));
+    } else if (!spillRuns.empty()) {
+        names = &candidates;
+        StreamTop<Keys<PickupZone, Hour>> best(k, groups, candidates);
+        bool ok = forEachMergedZone([&best](const ZoneRecord& rec) {
+            for (int hour = 0; hour < 24; ++hour)
+                if (rec.hours[hour] > 0) best.offer(rec.zone, hour, rec.hours[hour]);
+        });
+        if (!ok) groups.clear();
+    } else {
+        for (uint32_t z = 0; z < zones.size(); ++z) {
+            if (slotCounts.rowEmpty(z)) continue;
+            for (int hour = 0; hour < 24; ++hour) {
+                long long c = slotCounts.get(z, hour);
+                if (c > 0) groups.push_back(Q::group(z, hour, c));
+            }
+        }
+    }
+
+    if (groups.empty() || k <= 0) {
+        if (prof) perf.stop();
+        return {};
+    }
+    Q::Groups::selectTop(groups, k, *names, [&] {
+        if (prof) {
+            phaseProfile.select = perf.stop();
+            perf.start();
+        }
+    });
+    if (prof) phaseProfile.sort = perf.stop();
     std::vector<SlotCount> result;
+    result.reserve(groups.size());
+    for (const auto& g : groups)
+        result.push_back({string(names->name(Q::zone(g))), (int)Q::Groups::field<1>(g.key),
+                          get<0>(g.values)});
+    return result;
+}
 
 
-    result.reserve(slotMapCount.size() * 24);
-    for (const auto& entry : slotMapCount) {
-        const auto& zone = entry.first;
-        const auto& hourArray = entry.second;
-        for (int hour = 0; hour < 24; ++hour) {
-            if (hourArray[hour] > 0) {
-                result.push_back({zone, hour, hourArray[hour]});
+void TripAnalyzer::merge(const TripAnalyzer& other) {
+    if (ingestMode == IngestMode::Sketch) {
+        tripSketch.merge(other.tripSketch);
+    } else {
+        spillRuns.insert(spillRuns.end(), other.spillRuns.begin(), other.spillRuns.end());
+        compactRuns();
+        for (uint32_t oz = 0; oz < other.zones.size(); ++oz) {
+            if (other.zoneTotals[oz] == 0) continue;
+            if (memoryBudget && zones.size() > spillAtZones) spill();
+            if (ingestStats.spillFailed) break;
+            uint32_t z = zones.findOrInsert(other.zones.name(oz));
+            if (z == zoneTotals.size()) {
+                zoneTotals.push_back(0);
+                slotCounts.addZone();
+            }
+            zoneTotals[z] += other.zoneTotals[oz];
+            for (int h = 0; h < 24; ++h) {
+                long long c = other.slotCounts.get(oz, h);
+                if (c) slotCounts.add(z, h, c);
+            }
+            if (quantilesEnabled) {
+                for (uint32_t slot = 0; slot < kQuantileSlots; ++slot) {
+                    fareQuantiles.merge(z * kQuantileSlots + slot, other.fareQuantiles, oz * kQuantileSlots + slot);
+                    distanceQuantiles.merge(z * kQuantileSlots + slot, other.distanceQuantiles,
+                                            oz * kQuantileSlots + slot);
+                }
             }
         }
     }
+    ingestStats.rowsRead += other.ingestStats.rowsRead;
+    ingestStats.rowsAccepted += other.ingestStats.rowsAccepted;
+    ingestStats.rowsMalformed += other.ingestStats.rowsMalformed;
+    ingestStats.duplicatesRejected += other.ingestStats.duplicatesRejected;
+    ingestStats.unknownZones += other.ingestStats.unknownZones;
+    ingestStats.spillRuns += other.ingestStats.spillRuns;
+    ingestStats.rowsQuarantined += other.ingestStats.rowsQuarantined;
+    ingestStats.filesRead += other.ingestStats.filesRead;
+    ingestStats.bytesRead += other.ingestStats.bytesRead;
+    ingestStats.spillFailed |= other.ingestStats.spillFailed;
+}
 
-    if (result.empty() || k <= 0) return {};
-    int kk = min(k, (int)result.size());
-    nth_element(result.begin(), result.begin() + kk, result.end(),
-        [](const SlotCount& a, const SlotCount& b) {
-            if (a.count != b.count)
-                return a.count > b.count; 
-            if (a.zone != b.zone)
-                return a.zone < b.zone; 
-            return a.hour < b.hour;     
-        });
-    sort(result.begin(), result.begin() + kk,
-        [](const SlotCount& a, const SlotCount& b) {
-            if (a.count != b.count)
-                return a.count > b.count; 
-            if (a.zone != b.zone)
-                return a.zone < b.zone; 
-            return a.hour < b.hour;     
-        });
-    result.resize(kk);
-    return result;
+bool TripAnalyzer::saveSnapshot(const string& path) const {
+    SnapshotWriter writer;
+    if (!writer.open(path)) return false;
+    bool ok = forEachMergedZone([&writer](const ZoneRecord& rec) { writer.write(rec); });
+    return writer.close() && ok;
 }
 
+bool TripAnalyzer::loadSnapshot(const string& path) {
+    SnapshotReader reader;
+    if (!reader.open(path)) return false;
+    ZoneTable loadedZones;
+    loadedZones.setHugePages(hugePages);
+    loadedZones.setCatalog(zones.catalog());
+    HugeVector<long long> totals(loadedZones.size(), 0, HugePageAllocator<long long>{hugePages});
+    SlotMatrix hours;
+    hours.setHugePages(hugePages);
+    for (size_t z = 0; z < loadedZones.size(); ++z) hours.addZone();
+    loadedZones.reserve(reader.zoneCount());
+    ZoneRecord rec;
+    while (reader.next(rec)) {
+        uint32_t z = loadedZones.findOrInsert(rec.zone);
+        if (z == totals.size()) {
+            totals.push_back(0);
+            hours.addZone();
+        }
+        totals[z] += rec.total;
+        for (int h = 0; h < 24; ++h)
+            if (rec.hours[h]) hours.add(z, h, rec.hours[h]);
+    }
+    if (reader.failed()) return false;
+    ingestMode = IngestMode::Exact;
+    spillRuns.clear();
+    zones = std::move(loadedZones);
+    zoneTotals.swap(totals);
+    slotCounts = std::move(hours);
+    fareQuantiles.clear();
+    distanceQuantiles.clear();
+    return true;
+}
+
+vector<double> TripAnalyzer::zoneQuantiles(string_view zone, TripValue value, const vector<double>& qs,
+                                           int hour) const {
+    uint32_t z = zones.find(zone);
+    if (z == ZoneTable::kNone || hour < -1 || hour > 23) return {};
+    const QuantileSketches& sketches = value == TripValue::Fare ? fareQuantiles : distanceQuantiles;
+    uint32_t id = z * kQuantileSlots + (hour < 0 ? 24 : hour);
+    if (sketches.count(id) == 0) return {};
+    vector<double> out;
+    for (double q : qs) out.push_back(sketches.quantile(id, q));
+    return out;
+}
@@ -3,6 +3,17 @@
 #include <vector>
 #include <unordered_map>
 #include <array>
+#include "sketch.h"
+#include "dedup.h"
+#include "snapshot.h"
+#include "perfcounters.h"
+#include "zonetable.h"
+#include "slotmatrix.h"
+#include "quantiles.h"
+#include "columns.h"
+#include "quarantine.h"
+#include "checkpoint.h"
+#include "asyncreader.h"
 using namespace std;
 struct ZoneCount {
     std::string zone;
@@ -15,13 +26,263 @@ struct SlotCount {
     long long count;
 };
 
+// Counters for the most recent ingestFile call.
+struct IngestStats {
+    long long rowsRead = 0;           // data rows, header excluded
+    long long rowsAccepted = 0;
+    long long rowsMalformed = 0;
+    long long duplicatesRejected = 0; // only with dedup enabled
+    long long unknownZones = 0;       // only with a catalog and UnknownZonePolicy::Reject
+    long long spillRuns = 0;          // sorted runs written under a memory budget
+    long long rowsQuarantined = 0;    // rejected rows written to the quarantine file
+    long long checkpointsWritten = 0; // only with setCheckpoint
+    long long resumedBytes = 0;       // input already counted by the checkpoint resumed from
+    bool stopped = false;             // ended early at a checkpoint by stopIngest()
+    bool spillFailed = false;         // a spill run could not be written or merged; ingest stopped there
+    long long filesRead = 0;
+    long long bytesRead = 0;
+};
+
+// Hardware counters per phase, filled only with profiling enabled. select
+// and sort describe the most recent topZones/topBusySlots call.
+struct PhaseProfile {
+    PerfSample ingest;
+    PerfSample select;    // candidate gathering + nth_element
+    PerfSample sort;      // ordering of the k winners
+};
+
+// Exact keeps per-zone state for the lifetime of one ingest. Sketch keeps
+// a fixed-size, mergeable TripSketch that accumulates across ingestFile
+// calls, for feeds that never end.
+enum class IngestMode { Exact, Sketch };
+
+// How file bytes reach the row parser. Getline is the original ifstream
+// loop; Mmap maps the whole file; Stream reads fixed-size chunks with
+// read(2) so memory stays bounded regardless of file size; Async keeps
+// several large reads in flight (see AsyncFileReader) and parses each
+// block as it completes, for cold-cache reads from fast disks.
+enum class ReadMode { Getline, Mmap, Stream, Async };
+
+// Per-trip values that can be summarised by quantile sketches.
+enum class TripValue { Fare, Distance };
+
+// What ingest does with a pickup zone missing from the loaded catalog.
+enum class UnknownZonePolicy { Fallback, Reject };
 
 class TripAnalyzer {
 public:
     void ingestFile(const string& csvPath);
+    // All files count towards one result; with threads > 1 files (or, in
+    // Mmap mode, line-aligned ranges of a single file) are parsed in
+    // parallel into private analyzers and merged.
+    void ingestFiles(const vector<string>& csvPaths);
     std::vector<ZoneCount> topZones(int k = 10) const;
     std::vector<SlotCount> topBusySlots(int k = 10) const;
-    std::unordered_map<std::string, long long> zoneMapCount;
-    std::unordered_map<std::string, array<long long, 24>> slotMapCount;
-};
 
+    void setMode(IngestMode mode) { ingestMode = mode; }
+    IngestMode mode() const { return ingestMode; }
+    void setReadMode(ReadMode mode) { readMode = mode; }
+    // Async mode: reads in flight per file, their size, and the I/O backend.
+    void setAsyncReads(int depth, size_t blockBytes = AsyncFileReader::kDefaultBlock,
+                       AsyncFileReader::Backend backend = AsyncFileReader::Backend::Auto) {
+        asyncDepth = depth < 1 ? 1 : depth;
+        asyncBlockBytes = blockBytes;
+        asyncBackend = backend;
+    }
+    // Dedup needs one global seen-set, so it keeps ingest single-threaded.
+    void setThreads(int n) { threadCount = n < 1 ? 1 : n; }
+    // Back the counter matrix and zone hash table with 2 MB pages (Exact
+    // mode; applied at the start of the next ingest). Falls back to normal
+    // pages when the host has none to give; see hugePageUsage().
+    void setHugePages(HugePagePolicy policy) { hugePages = policy; }
+    // Restrict the dictionary to a known zone list (one ID per line): its
+    // zones resolve through a minimal perfect hash, and other zones are
+    // either counted in the general table or rejected into
+    // stats().unknownZones. Replaces any exact state; false if unreadable.
+    bool loadZoneCatalog(const string& path, UnknownZonePolicy policy = UnknownZonePolicy::Fallback);
+    // Cap the exact tables (Exact mode) at about bytes: when they fill, the
+    // state is written as a zone-sorted run under spillDir (default
+    // $TMPDIR or /tmp) and counting restarts empty. Queries, merge and
+    // saveSnapshot stream-merge the runs with memory, so results stay
+    // exact; top-k then holds only k candidates. 0 = no budget. If a run
+    // cannot be written, ingest stops and stats().spillFailed is set; if
+    // one cannot be read back, queries return nothing, saveSnapshot
+    // fails and spillReadFailed() is set.
+    void setMemoryBudget(size_t bytes, const string& spillDir = "");
+    // Exact mode: also keep fare and distance quantile sketches per zone
+    // and per (zone, hour), from the last two columns (unparsable values
+    // are left out). They are memory-only: a memory budget does not spill
+    // while they are on, and snapshots do not carry them.
+    void setQuantiles(bool on) { quantilesEnabled = on; }
+    // The zone's values at ranks qs (hour -1 = all hours); empty if the
+    // zone has none.
+    vector<double> zoneQuantiles(string_view zone, TripValue value, const vector<double>& qs,
+                                 int hour = -1) const;
+    vector<double> zoneFareQuantiles(string_view zone, const vector<double>& qs) const {
+        return zoneQuantiles(zone, TripValue::Fare, qs);
+    }
+    // Sketch mode only; counts in topZones/topBusySlots are then estimates.
+    const TripSketch& sketch() const { return tripSketch; }
+    TripSketch& sketch() { return tripSketch; }
+    double approxDistinctZones() const { return tripSketch.distinctZones(); }
+    double approxDistinctTrips() const { return tripSketch.distinctTrips(); }
+
+    // Write rejected rows (malformed, unknown zone, duplicate) with a
+    // reason and byte offset to a CSV side file; see QuarantineSink for
+    // sampling and the cap. Kept for later ingests; false if path cannot
+    // be created. Rows are only looked at once already rejected.
+    bool setQuarantine(const string& path, long long sampleEvery = 1, long long maxRows = -1);
+    const QuarantineSink* quarantine() const { return quarantineSink.get(); }
+
+    // Resumable ingest (Exact mode without dedup, quantiles or a memory
+    // budget; see checkpointing()): after about every everyBytes of input the
+    // state goes to a background thread that writes it to path, with the
+    // file offset and a fingerprint of the bytes before it (see
+    // CheckpointWriter). An ingest that finds a checkpoint of the same
+    // inputs, still matching its fingerprint, starts where it ends; one
+    // that completes removes it. Files are read one at a time, on one
+    // thread, while checkpointing.
+    void setCheckpoint(const string& path, long long everyBytes = 256ll << 20) {
+        checkpointPath = path;
+        checkpointEvery = everyBytes < 1 ? 1 : everyBytes;
+    }
+    // Whether the next ingest checkpoints: a path is set and the settings
+    // are ones whose state a checkpoint carries. Otherwise it ingests as
+    // usual and stopIngest has no effect. Snapshots cannot carry dedup or
+    // quantile state. A memory budget is excluded too: a checkpoint holds
+    // the whole state in one snapshot, which would mean merging every spill
+    // run into memory on the parse thread and loading it all back on resume.
+    bool checkpointing() const {
+        return !checkpointPath.empty() && ingestMode == IngestMode::Exact && !dedupEnabled && !quantilesEnabled &&
+               memoryBudget == 0;
+    }
+    // Asks a checkpointing ingest to end at its next checkpoint and leave
+    // it for a later run (stats().stopped). Safe from another thread or a
+    // signal handler; a request made before an ingest applies to it.
+    void stopIngest() { stopRequested->store(true); }
+
+    // Reject rows whose TripID was already ingested. The seen-set follows
+    // the mode: reset per ingestFile in Exact, kept across calls in Sketch.
+    void setDedup(bool on) { dedupEnabled = on; }
+    // Require the whole pickup time to be a valid "YYYY-MM-DD HH:MM" (with
+    // optional ":SS"); by default only the hour digits are checked.
+    void setStrictTimestamps(bool on) { strictTimestamps = on; }
+    const IngestStats& stats() const { return ingestStats; }
+    // A query or saveSnapshot found a spill run missing or damaged.
+    bool spillReadFailed() const { return runReadFailed; }
+
+    // Opt-in perf_event_open sampling of ingest/select/sort. Counters the
+    // host does not expose read as invalid rather than failing the run.
+    void setProfiling(bool on) { profilingEnabled = on; }
+    const PhaseProfile& profile() const { return phaseProfile; }
+
+    // Shard support: fold another analyzer in (O(distinct keys of other)),
+    // or persist/restore the exact state as a zone-sorted snapshot file.
+    void merge(const TripAnalyzer& other);
+    bool saveSnapshot(const string& path) const;
+    bool loadSnapshot(const string& path);
+
+private:
+    void ingestAll(const vector<string>& csvPaths);
+    void beginIngest();
+    void resetExact();
+    void finishIngest();
+    TripAnalyzer makeWorker(int workers) const;
+    bool ingestPath(const string& path, long long resumeAt = 0);
+    bool ingestAsync(const string& path, long long resumeAt);
+    void ingestCheckpointed(const vector<string>& csvPaths);
+    bool ingestRangeCheckpointed(const char* base, const char* p, const char* end);
+    // True when the ingest is to stop at offset.
+    bool checkpointDue(long long offset) {
+        return checkpointWriter && offset >= nextCheckpoint && checkpoint(offset);
+    }
+    bool checkpoint(long long offset);
+    void ingestRange(const char* p, const char* end);
+    void ingestLine(const char* b, const char* e);
+
+    // A validated row; the views point into the reader's buffer. Rows are
+    // parsed in batches of kIngestBatch so the zone table slots (and
+    // then the counters) of the whole batch are prefetched before any is
+    // touched, overlapping the cache misses of high-cardinality inputs.
+    struct ParsedRow {
+        string_view zone;
+        string_view tripId;
+        uint64_t key;     // ZoneTable::probe
+        int hour;
+        float distance, fare;   // only with quantiles on
+        const char* line;       // the raw row, for the quarantine
+        uint32_t lineLength;
+    };
+    static const int kIngestBatch = 32;
+    // Zone tables + counters + a typical name, for sizing under a budget.
+    static const size_t kBytesPerZone = 128;
+    // Quantile sketch ids: zone * kQuantileSlots + hour, hour 24 = zone.
+    static const uint32_t kQuantileSlots = 25;
+    // A checkpoint due while the last one is still being written waits
+    // for this much more input instead of stalling the parser.
+    static const long long kCheckpointRetry = 1 << 20;
+    // Spill runs are merged into one when there are this many, which
+    // bounds the files a query holds open.
+    static const size_t kSpillFanIn = 64;
+    // Unescaped copies of quoted fields, at most two per pending row.
+    static const int kQuoteScratch = 2 * kIngestBatch;
+    void useHeader(string_view header);
+    __attribute__((noinline, cold)) bool reject(RejectReason reason, const char* b, const char* e);
+    bool parseLine(const char* b, const char* e, ParsedRow& row);
+    string_view unquote(string_view field);
+    void applyRows(const ParsedRow* rows, int n);
+
+    size_t exactBytes() const;
+    vector<uint32_t> sortedZones() const;
+    void spill();
+    void compactRuns();
+    bool forEachMergedZone(const function<void(const ZoneRecord&)>& sink) const;
+
+    // Exact state: zone i of the dictionary owns zoneTotals[i] and row i
+    // of slotCounts. Dense arrays keep the steady-state ingest allocation-free.
+    ZoneTable zones;
+    HugeVector<long long> zoneTotals;
+    SlotMatrix slotCounts;
+    HugePagePolicy hugePages = HugePagePolicy::Off;
+    UnknownZonePolicy unknownZonePolicy = UnknownZonePolicy::Fallback;
+    size_t memoryBudget = 0;
+    string spillDirectory;
+    size_t spillAtZones = 0;            // zone count that triggers the next spill
+    vector<shared_ptr<ScratchSnapshot>> spillRuns;
+    mutable bool runReadFailed = false;
+    bool quantilesEnabled = false;
+    bool strictTimestamps = false;
+    shared_ptr<QuarantineSink> quarantineSink;
+    string currentFile;
+    string currentHeader;               // kept only while checkpointing
+    string checkpointPath;
+    long long checkpointEvery = 0;
+    shared_ptr<CheckpointWriter> checkpointWriter;   // during a checkpointed ingest
+    uint64_t checkpointGeneration = 0;
+    size_t checkpointFile = 0;          // index of currentFile in the inputs
+    long long nextCheckpoint = 0;       // offset in currentFile
+    long long fileStartBytes = 0;       // bytesRead before currentFile
+    shared_ptr<atomic<bool>> stopRequested = make_shared<atomic<bool>>(false);
+    const char* rangeBase = nullptr;    // buffer byte that sits at file offset rangeOffset
+    long long rangeOffset = 0;
+    ColumnMap columns;                  // layout of the file being read
+    int columnCommas = ColumnMap::kColumns - 1;
+    RowFields mappedRow;
+    string quoteScratch[kQuoteScratch];
+    int nextQuoteScratch = 0;
+    QuantileSketches fareQuantiles, distanceQuantiles;
+
+    IngestMode ingestMode = IngestMode::Exact;
+    ReadMode readMode = ReadMode::Getline;
+    int asyncDepth = AsyncFileReader::kDefaultDepth;
+    size_t asyncBlockBytes = AsyncFileReader::kDefaultBlock;
+    AsyncFileReader::Backend asyncBackend = AsyncFileReader::Backend::Auto;
+    int threadCount = 1;
+    TripSketch tripSketch;
+    bool dedupEnabled = false;
+    TripIdDedup seenTripIds;
+    IngestStats ingestStats;
+    bool profilingEnabled = false;
+    mutable PerfCounters perf;
+    mutable PhaseProfile phaseProfile;
+};
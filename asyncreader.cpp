@@ -0,0 +1,313 @@
+#include "asyncreader.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+using namespace std;
+
+struct AsyncFileReader::Engine {
+    virtual ~Engine() {}
+    virtual bool submit(int fd, int slot, char* buf, size_t len, uint64_t at) = 0;
+    virtual long long wait(int slot) = 0;
+};
+
+// pread until len bytes or end of file; -errno on failure.
+static long long readFully(int fd, char* buf, size_t len, uint64_t at) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, buf + got, len - got, (off_t)(at + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -errno;
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    return (long long)got;
+}
+
+// ---------------- io_uring ----------------
+// The rings are used directly: this thread is the only submitter and the
+// only consumer, so the head/tail protocol needs just acquire/release.
+
+struct AsyncFileReader::Uring : AsyncFileReader::Engine {
+    int ring = -1;
+    void* sqMap = MAP_FAILED;
+    void* cqMap = MAP_FAILED;
+    void* sqeMap = MAP_FAILED;
+    size_t sqMapSize = 0, cqMapSize = 0, sqeMapSize = 0;
+    unsigned *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    vector<iovec> iov;
+    vector<long long> result;
+    vector<char> done;
+
+    bool init(int entries) {
+        io_uring_params p;
+        memset(&p, 0, sizeof p);
+        ring = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (ring < 0) return false;
+        sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sqMapSize = cqMapSize = max(sqMapSize, cqMapSize);
+        sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) return false;
+        if (!single) {
+            cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+            if (cqMap == MAP_FAILED) return false;
+        }
+        sqeMapSize = p.sq_entries * sizeof(io_uring_sqe);
+        sqeMap = mmap(nullptr, sqeMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED) return false;
+
+        char* sq = (char*)sqMap;
+        char* cq = single ? sq : (char*)cqMap;
+        sqTail = (unsigned*)(sq + p.sq_off.tail);
+        sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + p.sq_off.array);
+        cqHead = (unsigned*)(cq + p.cq_off.head);
+        cqTail = (unsigned*)(cq + p.cq_off.tail);
+        cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+        sqes = (io_uring_sqe*)sqeMap;
+        iov.resize(entries);
+        result.assign(entries, 0);
+        done.assign(entries, 1);
+        return true;
+    }
+
+    ~Uring() override {
+        if (sqeMap != MAP_FAILED) munmap(sqeMap, sqeMapSize);
+        if (cqMap != MAP_FAILED) munmap(cqMap, cqMapSize);
+        if (sqMap != MAP_FAILED) munmap(sqMap, sqMapSize);
+        if (ring >= 0) ::close(ring);
+    }
+
+    bool submit(int fd, int slot, char* buf, size_t len, uint64_t at) override {
+        unsigned tail = *sqTail;
+        unsigned idx = tail & *sqMask;
+        io_uring_sqe& sqe = sqes[idx];
+        memset(&sqe, 0, sizeof sqe);
+        iov[slot] = {buf, len};
+        sqe.opcode = IORING_OP_READV;     // READ needs 5.6; READV works since 5.1
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)&iov[slot];
+        sqe.len = 1;
+        sqe.off = at;
+        sqe.user_data = (uint64_t)slot;
+        sqArray[idx] = idx;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        done[slot] = 0;
+        for (;;) {
+            long r = syscall(__NR_io_uring_enter, ring, 1, 0, 0, nullptr, 0);
+            if (r == 1) return true;
+            if (r < 0 && errno == EINTR) continue;
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);   // not consumed: take it back
+            done[slot] = 1;
+            return false;
+        }
+    }
+
+    long long wait(int slot) override {
+        while (!done[slot]) {
+            unsigned head = *cqHead;
+            if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                long r = syscall(__NR_io_uring_enter, ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (r < 0 && errno != EINTR) return -errno;
+                continue;
+            }
+            const io_uring_cqe& c = cqes[head & *cqMask];
+            result[c.user_data] = c.res;
+            done[c.user_data] = 1;
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        }
+        return result[slot];
+    }
+};
+
+// ---------------- pread pool ----------------
+
+struct AsyncFileReader::Pool : AsyncFileReader::Engine {
+    struct Job {
+        int fd, slot;
+        char* buf;
+        size_t len;
+        uint64_t at;
+    };
+    mutex lock;
+    condition_variable work, finished;
+    deque<Job> jobs;
+    vector<long long> result;
+    vector<char> done;
+    bool stopping = false;
+    vector<thread> threads;
+
+    explicit Pool(int n) : result(n, 0), done(n, 1) {
+        for (int i = 0; i < n; ++i) threads.emplace_back([this] { run(); });
+    }
+
+    ~Pool() override {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        work.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    bool submit(int fd, int slot, char* buf, size_t len, uint64_t at) override {
+        {
+            lock_guard<mutex> guard(lock);
+            done[slot] = 0;
+            jobs.push_back({fd, slot, buf, len, at});
+        }
+        work.notify_one();
+        return true;
+    }
+
+    long long wait(int slot) override {
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return done[slot] != 0; });
+        return result[slot];
+    }
+
+    void run() {
+        unique_lock<mutex> guard(lock);
+        for (;;) {
+            work.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            Job j = jobs.front();
+            jobs.pop_front();
+            guard.unlock();
+            long long n = readFully(j.fd, j.buf, j.len, j.at);
+            guard.lock();
+            result[j.slot] = n;
+            done[j.slot] = 1;
+            finished.notify_all();
+        }
+    }
+};
+
+// ---------------- reader ----------------
+
+AsyncFileReader::AsyncFileReader() {}
+
+AsyncFileReader::~AsyncFileReader() {
+    close();
+}
+
+// Blocks are at most blockBytes but no larger than the rest of the file
+// needs, and there are no more slots than blocks, so a small file costs
+// one small buffer and one read.
+bool AsyncFileReader::open(const string& path, uint64_t from, size_t blockBytes, int depth, Backend backend) {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close();
+        return false;
+    }
+    fileSize = (uint64_t)st.st_size;
+    start = min(from, fileSize);
+    const size_t kPage = 4096;
+    uint64_t rest = fileSize - start;
+    blockSize = (max(blockBytes, kPage) + kPage - 1) / kPage * kPage;
+    blockSize = (size_t)min<uint64_t>(blockSize, max<uint64_t>((rest + kPage - 1) / kPage * kPage, kPage));
+    blocks = (rest + blockSize - 1) / blockSize;
+    slots = (int)min<uint64_t>(max(depth, 1), max<uint64_t>(blocks, 1));
+    nextBlock = issued = 0;
+    blockOffset = start;
+    failed = false;
+
+    if (backend != Backend::Threads) {
+        auto uring = make_unique<Uring>();
+        if (uring->init(slots)) {
+            engine = std::move(uring);
+            active = Backend::IoUring;
+        } else if (backend == Backend::IoUring) {
+            close();
+            return false;
+        }
+    }
+    if (!engine) {
+        engine = make_unique<Pool>(slots);
+        active = Backend::Threads;
+    }
+    if (posix_memalign((void**)&buffers, kPage, blockSize * slots) != 0) {
+        buffers = nullptr;
+        close();
+        return false;
+    }
+    while (!failed && issued < blocks && issued < (uint64_t)slots) issue(issued);
+    return !failed;
+}
+
+void AsyncFileReader::issue(uint64_t block) {
+    int slot = (int)(block % slots);
+    uint64_t at = start + block * blockSize;
+    size_t len = (size_t)min<uint64_t>(blockSize, fileSize - at);
+    if (!engine->submit(fd, slot, buffers + slot * blockSize, len, at)) {
+        failed = true;
+        return;
+    }
+    ++issued;
+}
+
+bool AsyncFileReader::next(const char*& data, size_t& size) {
+    if (fd < 0 || failed) return false;
+    // The slot handed out last is free again.
+    if (nextBlock > 0 && issued < blocks) issue(issued);
+    if (failed) return false;
+    if (nextBlock == blocks) {
+        data = nullptr;
+        size = 0;
+        blockOffset = fileSize;
+        return true;
+    }
+    int slot = (int)(nextBlock % slots);
+    uint64_t at = start + nextBlock * blockSize;
+    size_t want = (size_t)min<uint64_t>(blockSize, fileSize - at);
+    char* buf = buffers + slot * blockSize;
+    long long n = engine->wait(slot);
+    // A short read (the file shrank, or the kernel stopped early) is
+    // finished synchronously.
+    if (n >= 0 && (size_t)n < want) {
+        long long more = readFully(fd, buf + n, want - n, at + n);
+        n = more < 0 ? more : n + more;
+    }
+    if (n < 0) {
+        failed = true;
+        return false;
+    }
+    ++nextBlock;
+    blockOffset = at;
+    data = buf;
+    size = (size_t)n;
+    return true;
+}
+
+// Reads still in flight write into the buffers, so they are waited for
+// before anything is released.
+void AsyncFileReader::close() {
+    if (engine)
+        for (uint64_t b = nextBlock; b < issued; ++b) engine->wait((int)(b % slots));
+    engine.reset();
+    free(buffers);
+    buffers = nullptr;
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    nextBlock = issued = blocks = 0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Reads one file front to back in blocks of blockBytes, keeping up to
+// depth reads in flight so the device queue stays busy while the caller
+// parses. Blocks come back in file order whichever read completes first.
+//   IoUring  one io_uring (raw syscalls, no liburing) per reader;
+//   Threads  depth threads issuing pread(2), for kernels or sandboxes
+//            that refuse io_uring;
+//   Auto     IoUring if it can be set up, else Threads.
+class AsyncFileReader {
+public:
+    enum class Backend { Auto, IoUring, Threads };
+    static const size_t kDefaultBlock = 4 << 20;
+    static const int kDefaultDepth = 4;
+
+    AsyncFileReader();
+    ~AsyncFileReader();
+    AsyncFileReader(const AsyncFileReader&) = delete;
+    AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+    // Starts reading path at byte offset start. False if the file cannot
+    // be opened or (Backend::IoUring) the kernel offers no io_uring.
+    bool open(const string& path, uint64_t start = 0, size_t blockBytes = kDefaultBlock,
+              int depth = kDefaultDepth, Backend backend = Backend::Auto);
+    // The next block; size 0 at the end of the file. The block stays
+    // valid until the following call. False on a read error.
+    bool next(const char*& data, size_t& size);
+    // File offset of the block returned last.
+    uint64_t offset() const { return blockOffset; }
+    // The backend in use after open (never Auto).
+    Backend backend() const { return active; }
+    void close();
+
+private:
+    // Reads into buffer slots; wait returns the byte count or -errno.
+    struct Engine;
+    struct Uring;
+    struct Pool;
+    void issue(uint64_t block);
+    int fd = -1;
+    unique_ptr<Engine> engine;
+    Backend active = Backend::Auto;
+    size_t blockSize = 0;
+    int slots = 0;
+    uint64_t start = 0, fileSize = 0;
+    uint64_t blocks = 0, nextBlock = 0, issued = 0;
+    uint64_t blockOffset = 0;
+    char* buffers = nullptr;          // slots * blockSize, page aligned
+    bool failed = false;
+};
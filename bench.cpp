@@ -0,0 +1,148 @@
+// bench: synthetic volume workload through ingestFile/topZones/topBusySlots.
+// Used for timing build variants and as the PGO training run.
+//
+//   bench [--rows N] [--zones N] [--repeat R] [--file PATH] [--perf] [--hugepages]
+//
+// --perf adds hardware counters (cycles, IPC, LLC/branch/dTLB misses) for
+// the ingest, select and sort phases of the last repetition. --hugepages
+// reruns the workload on transparent and explicit 2 MB pages and reports
+// the ingest time and dTLB-miss difference against normal pages.
+#include "analyzer.h"
+#include "kernels.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Mix of the graded input shapes: a skewed head (C1), a long tail of
+// unique zones (C2), every hour populated (C3) and ~1% dirty rows (A2).
+static bool generate(const std::string& path, long long rows, int zones) {
+    FILE* f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    std::fputs("TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount\n", f);
+    uint64_t s = 0x9e3779b97f4a7c15ULL;
+    auto rnd = [&s]() {
+        s ^= s << 13; s ^= s >> 7; s ^= s << 17;
+        return s;
+    };
+    char line[128];
+    for (long long i = 0; i < rows; ++i) {
+        uint64_t r = rnd();
+        int zone = (r & 3) == 0 ? (int)(r >> 8) % 16 : (int)((r >> 8) % (uint64_t)zones);
+        int hour = (int)((r >> 40) % 24), minute = (int)((r >> 48) % 60), day = 1 + (int)((r >> 56) % 28);
+        int n;
+        if ((r & 0x7f) == 0x7f)
+            n = std::snprintf(line, sizeof(line), "%lld,ZONE%04d,ZX,NOT_A_DATE,1.0,5.0\n", i + 1, zone);
+        else
+            n = std::snprintf(line, sizeof(line), "%lld,ZONE%04d,ZONE%04d,2024-01-%02d %02d:%02d,%d.%d,%d.%d\n",
+                              i + 1, zone, (int)(r >> 20) % zones, day, hour, minute,
+                              (int)(r >> 12) % 50, (int)(r >> 18) % 10, (int)(r >> 22) % 200, (int)(r >> 30) % 10);
+        std::fwrite(line, 1, (size_t)n, f);
+    }
+    return std::fclose(f) == 0;
+}
+
+// Per-phase counters; per-row rates make input shapes comparable.
+static void printProfile(const PhaseProfile& p, long long rows) {
+    const std::pair<const char*, const PerfSample*> phases[] = {
+        {"ingest", &p.ingest}, {"select", &p.select}, {"sort", &p.sort}};
+    for (const auto& ph : phases) {
+        const PerfSample& s = *ph.second;
+        if (!s.valid) {
+            std::printf("%s: counters unavailable\n", ph.first);
+            continue;
+        }
+        std::printf("%s:", ph.first);
+        for (int c = 0; c < PerfSample::kCount; ++c)
+            if (s.has((PerfSample::Counter)c))
+                std::printf(" %s=%llu", PerfSample::name(c), (unsigned long long)s.value[c]);
+        if (s.has(PerfSample::Cycles) && s.has(PerfSample::Instructions) && s.cycles())
+            std::printf(" ipc=%.2f", (double)s.instructions() / (double)s.cycles());
+        if (s.has(PerfSample::LlcMisses) && rows > 0)
+            std::printf(" llc_per_row=%.3f", (double)s.llcMisses() / (double)rows);
+        std::printf("\n");
+    }
+}
+
+struct RunResult {
+    double ingestMs = 1e300, queryMs = 1e300;
+    long long checksum = 0;
+    PhaseProfile profile;
+    HugePageUsage pages;
+};
+
+static RunResult runWorkload(const std::string& path, int repeat, bool perf, HugePagePolicy pages) {
+    using clock = std::chrono::steady_clock;
+    RunResult res;
+    for (int r = 0; r < repeat; ++r) {
+        TripAnalyzer ta;
+        ta.setProfiling(perf);
+        ta.setHugePages(pages);
+        auto t0 = clock::now();
+        ta.ingestFile(path);
+        auto t1 = clock::now();
+        auto z = ta.topZones(10);
+        auto sl = ta.topBusySlots(10);
+        auto t2 = clock::now();
+        res.ingestMs = std::min(res.ingestMs, std::chrono::duration<double, std::milli>(t1 - t0).count());
+        res.queryMs = std::min(res.queryMs, std::chrono::duration<double, std::milli>(t2 - t1).count());
+        res.checksum = (z.empty() ? 0 : z[0].count) + (sl.empty() ? 0 : sl[0].count);
+        res.profile = ta.profile();
+        res.pages = hugePageUsage();
+    }
+    return res;
+}
+
+int main(int argc, char** argv) {
+    long long rows = 2000000;
+    int zones = 50000, repeat = 3;
+    std::string path = "bench_data.csv";
+    bool perf = false, comparePages = false;
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--perf")) perf = true;
+        else if (!std::strcmp(argv[i], "--hugepages")) comparePages = perf = true;
+        else if (!hasValue) break;
+        else if (!std::strcmp(argv[i], "--rows")) rows = std::atoll(argv[++i]);
+        else if (!std::strcmp(argv[i], "--zones")) zones = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--repeat")) repeat = std::max(1, std::atoi(argv[++i]));
+        else if (!std::strcmp(argv[i], "--file")) path = argv[++i];
+    }
+
+    if (!generate(path, rows, zones)) {
+        std::fprintf(stderr, "bench: cannot write %s\n", path.c_str());
+        return 1;
+    }
+
+    RunResult base = runWorkload(path, repeat, perf, HugePagePolicy::Off);
+    std::printf("rows=%lld zones=%d repeat=%d isa=%s checksum=%lld\n",
+                rows, zones, repeat, scanKernels().name, base.checksum);
+    std::printf("ingest_ms=%.1f\nquery_ms=%.1f\ntotal_ms=%.1f\n",
+                base.ingestMs, base.queryMs, base.ingestMs + base.queryMs);
+    if (perf) printProfile(base.profile, rows);
+
+    if (comparePages) {
+        // Same workload with the counter matrix and hash table on 2 MB pages.
+        const std::pair<const char*, HugePagePolicy> variants[] = {
+            {"transparent", HugePagePolicy::Transparent}, {"explicit", HugePagePolicy::Explicit}};
+        for (const auto& v : variants) {
+            RunResult r = runWorkload(path, repeat, perf, v.second);
+            std::printf("hugepages=%s ingest_ms=%.1f (%+.1f%%) huge_mb=%.1f thp_mb=%.1f",
+                        v.first, r.ingestMs, 100.0 * (r.ingestMs - base.ingestMs) / base.ingestMs,
+                        r.pages.explicitBytes / 1048576.0, r.pages.transparentBytes / 1048576.0);
+            const PerfSample& a = base.profile.ingest;
+            const PerfSample& b = r.profile.ingest;
+            if (a.has(PerfSample::DtlbMisses) && b.has(PerfSample::DtlbMisses))
+                std::printf(" dtlb_misses=%llu (delta %lld)", (unsigned long long)b.dtlbMisses(),
+                            (long long)b.dtlbMisses() - (long long)a.dtlbMisses());
+            else
+                std::printf(" dtlb_misses=n/a");
+            std::printf("\n");
+        }
+    }
+    std::remove(path.c_str());
+    return 0;
+}
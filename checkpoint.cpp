@@ -0,0 +1,147 @@
+#include "checkpoint.h"
+#include "sketch.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+static const char kCheckpointMagic[4] = {'T', 'C', 'K', '2'};
+
+template <class T>
+static void putRaw(ofstream& out, const T& v) { out.write((const char*)&v, sizeof(T)); }
+
+template <class T>
+static bool getRaw(ifstream& in, T& v) { return (bool)in.read((char*)&v, sizeof(T)); }
+
+static void putString(ofstream& out, const string& s) {
+    putRaw(out, (uint32_t)s.size());
+    out.write(s.data(), s.size());
+}
+
+static bool getString(ifstream& in, string& s) {
+    uint32_t len;
+    if (!getRaw(in, len) || len > (1u << 20)) return false;
+    s.resize(len);
+    return len == 0 || (bool)in.read(&s[0], len);
+}
+
+static bool preadAll(int fd, char* buf, size_t n, uint64_t at) {
+    while (n > 0) {
+        ssize_t got = pread(fd, buf, n, (off_t)at);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        buf += got;
+        n -= (size_t)got;
+        at += (uint64_t)got;
+    }
+    return true;
+}
+
+// hash covers the first done bytes (a block boundary). Folds in the whole
+// blocks up to offset, then the partial block after them, into out.
+static bool extendFingerprint(const string& path, uint64_t offset, uint64_t& done, uint64_t& hash, uint64_t& out) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    vector<char> buf(kFingerprintBlock);
+    bool ok = true;
+    while (done + kFingerprintBlock <= offset) {
+        if (!(ok = preadAll(fd, buf.data(), kFingerprintBlock, done))) break;
+        hash = hashBytes(buf.data(), kFingerprintBlock, hash);
+        done += kFingerprintBlock;
+    }
+    if (ok) {
+        size_t rest = (size_t)(offset - done);
+        ok = preadAll(fd, buf.data(), rest, done);
+        out = hashBytes(buf.data(), rest, hash ^ offset);
+    }
+    close(fd);
+    return ok;
+}
+
+bool fingerprintFile(const string& path, uint64_t offset, uint64_t& out) {
+    uint64_t done = 0, hash = 0;
+    return extendFingerprint(path, offset, done, hash, out);
+}
+
+// ofstream has no fsync; reopen the finished file to push it to disk.
+static bool syncFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+string CheckpointWriter::statePath(const string& path, uint64_t generation) {
+    return path + ".state" + to_string(generation & 1);
+}
+
+bool CheckpointWriter::write(IngestCheckpoint& cp, vector<ZoneRecord>& state) {
+    if (cp.path != hashedPath || cp.offset < hashedTo) {
+        hashedPath = cp.path;
+        hashedTo = prefixHash = 0;
+    }
+    if (!extendFingerprint(cp.path, cp.offset, hashedTo, prefixHash, cp.fingerprint)) {
+        hashedPath.clear();
+        return false;
+    }
+    sort(state.begin(), state.end(), [](const ZoneRecord& a, const ZoneRecord& b) { return a.zone < b.zone; });
+    string stateFile = statePath(file, cp.generation);
+    SnapshotWriter snapshot;
+    if (!snapshot.open(stateFile)) return false;
+    for (const ZoneRecord& rec : state) snapshot.write(rec);
+    if (!snapshot.close() || !syncFile(stateFile)) return false;
+
+    string tmp = file + ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        out.write(kCheckpointMagic, 4);
+        putRaw(out, cp.generation);
+        putRaw(out, cp.fileIndex);
+        putRaw(out, cp.offset);
+        putRaw(out, cp.fingerprint);
+        putString(out, cp.path);
+        putString(out, cp.header);
+        putRaw(out, (uint32_t)cp.counters.size());
+        for (int64_t c : cp.counters) putRaw(out, c);
+        if (!out.flush()) return false;
+    }
+    return syncFile(tmp) && rename(tmp.c_str(), file.c_str()) == 0;
+}
+
+void CheckpointWriter::submit(IngestCheckpoint cp, vector<ZoneRecord> state) {
+    if (worker.joinable()) worker.join();
+    busy.store(true, memory_order_release);
+    worker = thread([this, cp = std::move(cp), state = std::move(state)]() mutable {
+        if (!write(cp, state)) failed = true;
+        busy.store(false, memory_order_release);
+    });
+}
+
+bool CheckpointWriter::finish() {
+    if (worker.joinable()) worker.join();
+    return !failed;
+}
+
+void CheckpointWriter::discard() {
+    finish();
+    for (const string& f : {file, file + ".tmp", statePath(file, 0), statePath(file, 1)}) unlink(f.c_str());
+}
+
+bool readCheckpoint(const string& path, IngestCheckpoint& cp) {
+    ifstream in(path, ios::binary);
+    char magic[4];
+    if (!in.read(magic, 4) || !equal(magic, magic + 4, kCheckpointMagic)) return false;
+    uint32_t n;
+    if (!getRaw(in, cp.generation) || !getRaw(in, cp.fileIndex) || !getRaw(in, cp.offset) ||
+        !getRaw(in, cp.fingerprint) || !getString(in, cp.path) || !getString(in, cp.header) ||
+        !getRaw(in, n) || n > 64)
+        return false;
+    cp.counters.resize(n);
+    for (int64_t& c : cp.counters)
+        if (!getRaw(in, c)) return false;
+    return true;
+}
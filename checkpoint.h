@@ -0,0 +1,69 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "snapshot.h"
+using namespace std;
+
+// How far a resumable ingest had got: the exact state after the first
+// offset bytes (a line boundary) of input number fileIndex, whose bytes
+// there hash to fingerprint. counters are the caller's ingest counters.
+struct IngestCheckpoint {
+    uint64_t generation = 0;
+    uint64_t fileIndex = 0;
+    uint64_t offset = 0;
+    uint64_t fingerprint = 0;
+    string path;
+    string header;            // the file's header line, for its column layout
+    vector<int64_t> counters;
+};
+
+// Hash of the first offset bytes of a file, so a resume notices a file
+// that was replaced or rewritten anywhere before the checkpoint. Bytes are
+// hashed in kFingerprintBlock pieces at fixed file offsets, which lets
+// the writer extend the hash from one checkpoint to the next instead of
+// rereading the prefix. False if the file is shorter than offset.
+static const size_t kFingerprintBlock = 1 << 20;
+bool fingerprintFile(const string& path, uint64_t offset, uint64_t& out);
+
+// Checkpoint files, all next to path:
+//   path             "TCK2" | u64 generation | u64 fileIndex | u64 offset
+//                    | u64 fingerprint | u32 len, path | u32 len, header
+//                    | u32 n | i64 counter * n
+//   path.state0/1    the state as a snapshot (see SnapshotWriter)
+// Generations alternate between the two state files, and path is
+// replaced by rename only after its state file is on disk, so a crash
+// at any point leaves the previous checkpoint whole.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(string path) : file(std::move(path)) {}
+    ~CheckpointWriter() { finish(); }
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    // False while the previous checkpoint is still being written.
+    bool idle() const { return !busy.load(memory_order_acquire); }
+    // Fingerprints cp's file up to cp.offset, then sorts and writes cp's
+    // state (one record per zone, any order) on a background thread; the
+    // caller must have seen idle().
+    void submit(IngestCheckpoint cp, vector<ZoneRecord> state);
+    // Waits for the write in flight; false if any write failed.
+    bool finish();
+    // Removes the checkpoint files.
+    void discard();
+    static string statePath(const string& path, uint64_t generation);
+
+private:
+    bool write(IngestCheckpoint& cp, vector<ZoneRecord>& state);
+    string file;
+    string hashedPath;        // prefixHash covers hashedTo bytes of it
+    uint64_t hashedTo = 0, prefixHash = 0;
+    thread worker;
+    atomic<bool> busy{false};
+    bool failed = false;
+};
+
+// False if path holds no readable checkpoint.
+bool readCheckpoint(const string& path, IngestCheckpoint& cp);
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+using namespace std;
+
+// Days since 1970-01-01 of a proleptic Gregorian date.
+inline long long daysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = (int)(y - era * 400);
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Inverse of daysFromCivil.
+inline void civilFromDays(long long days, int& y, int& m, int& d) {
+    days += 719468;
+    long long era = (days >= 0 ? days : days - 146096) / 146097;
+    int doe = (int)(days - era * 146097);
+    int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp + (mp < 10 ? 3 : -9);
+    y = (int)(yoe + era * 400) + (m <= 2);
+}
+
+struct CivilTime {
+    int year, month, day, hour, minute;
+};
+
+// Fields of the "YYYY-MM-DD HH:MM" at ts[0..15] (16 readable bytes),
+// checked without a branch per character: the two 8-byte halves are
+// tested at once for digits where digits belong and '-', ' ', ':' where
+// the separators do, and the range checks (month 1-12, day 1 to the
+// month's length in that year, hour 0-23, minute 0-59) fold into the
+// same flag. False on any mismatch.
+inline bool parseCivilTime(const char* ts, CivilTime& t) {
+    uint64_t a, b;                       // little endian: byte i is ts[i]
+    memcpy(&a, ts, 8);
+    memcpy(&b, ts + 8, 8);
+    const uint64_t kHigh = 0xF0F0F0F0F0F0F0F0ULL, kLow = 0x0F0F0F0F0F0F0F0FULL;
+    const uint64_t kAsciiZero = 0x3030303030303030ULL, kSix = 0x0606060606060606ULL;
+    auto notDigits = [&](uint64_t x, uint64_t mask) {
+        return (((x & kHigh) ^ kAsciiZero) | (((x & kLow) + kSix) & kHigh)) & mask;
+    };
+    // "YYYY-MM-" and "DD HH:MM"
+    uint64_t bad = notDigits(a, 0x00FFFF00FFFFFFFFULL) | notDigits(b, 0xFFFF00FFFF00FFFFULL) |
+                   ((a ^ 0x2D00002D00000000ULL) & 0xFF0000FF00000000ULL) |
+                   ((b ^ 0x00003A0000200000ULL) & 0x0000FF0000FF0000ULL);
+    a &= kLow;
+    b &= kLow;
+    auto digit = [](uint64_t x, int i) { return (unsigned)(x >> (8 * i)) & 0xF; };
+    t.year = (int)(digit(a, 0) * 1000 + digit(a, 1) * 100 + digit(a, 2) * 10 + digit(a, 3));
+    t.month = (int)(digit(a, 5) * 10 + digit(a, 6));
+    t.day = (int)(digit(b, 0) * 10 + digit(b, 1));
+    t.hour = (int)(digit(b, 3) * 10 + digit(b, 4));
+    t.minute = (int)(digit(b, 6) * 10 + digit(b, 7));
+    bad |= (unsigned)(t.month - 1) > 11u;
+    // Month lengths less 28, two bits per month from bit 2; February gains
+    // a day in leap years.
+    bool leap = (t.year % 4 == 0) & ((t.year % 100 != 0) | (t.year % 400 == 0));
+    unsigned monthDays = 28 + ((0x3BBEECCu >> ((t.month & 15) * 2)) & 3) + (t.month == 2 && leap);
+    bad |= (unsigned)(t.day - 1) >= monthDays;
+    bad |= (unsigned)t.hour > 23u;
+    bad |= (unsigned)t.minute > 59u;
+    return bad == 0;
+}
+
+// A whole timestamp field: "YYYY-MM-DD HH:MM", optionally followed by
+// ":SS" (00-59).
+inline bool validTimestamp(std::string_view ts, CivilTime& t) {
+    if (ts.size() != 16 && ts.size() != 19) return false;
+    if (!parseCivilTime(ts.data(), t)) return false;
+    if (ts.size() == 16) return true;
+    unsigned s1 = (unsigned)(ts[17] - '0'), s2 = (unsigned)(ts[18] - '0');
+    return ts[16] == ':' && s1 <= 5 && s2 <= 9;
+}
+
+// "YYYY-MM-DD HH:MM" -> minutes since 1970-01-01 00:00; -1 if the fields
+// are not digits in range or the date is before the epoch.
+inline long long parseEpochMinute(std::string_view ts) {
+    CivilTime t;
+    if (ts.size() < 16 || !parseCivilTime(ts.data(), t)) return -1;
+    long long days = daysFromCivil(t.year, t.month, t.day);
+    if (days < 0) return -1;
+    return days * 1440 + t.hour * 60 + t.minute;
+}
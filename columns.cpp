@@ -0,0 +1,66 @@
+#include "columns.h"
+#include "kernels.h"
+#include <algorithm>
+#include <cctype>
+#include <string>
+using namespace std;
+
+static bool sameName(string_view field, const char* name) {
+    while (!field.empty() && (field.front() == ' ' || field.front() == '"')) field.remove_prefix(1);
+    while (!field.empty() && (field.back() == ' ' || field.back() == '"' || field.back() == '\r'))
+        field.remove_suffix(1);
+    size_t i = 0;
+    for (; i < field.size() && name[i]; ++i)
+        if (tolower((unsigned char)field[i]) != tolower((unsigned char)name[i])) return false;
+    return i == field.size() && !name[i];
+}
+
+ColumnMap ColumnMap::fromHeader(string_view header) {
+    static const char* const kNames[kColumns] = {"TripID", "PickupZoneID", "DropoffZoneID",
+                                                 "PickupDateTime", "DistanceKm", "FareAmount"};
+    ColumnMap map;
+    fill(begin(map.index), end(map.index), -1);
+    RowFields fields;
+    const char* b = header.data();
+    const char* e = b + header.size();
+    fields.split(b, e, kMaxColumns - 1);
+    for (int col = 0; col < kMaxColumns; ++col) {
+        string_view name = fields[col];
+        if (name.data() == nullptr) break;
+        for (int c = 0; c < kColumns; ++c)
+            if (map.index[c] < 0 && sameName(name, kNames[c])) map.index[c] = col;
+    }
+    if (map.index[kPickup] < 0 || map.index[kTime] < 0) return ColumnMap();
+    map.standard = true;
+    for (int c = 0; c < kColumns; ++c) map.standard &= map.index[c] == c;
+    return map;
+}
+
+int ColumnMap::commasFor(unsigned mask) const {
+    if (standard) return kColumns - 1;
+    int last = 0;
+    for (int c = 0; c < kColumns; ++c)
+        if ((mask & bit((Column)c)) && index[c] > last) last = index[c];
+    return last;
+}
+
+bool RowFields::split(const char* b, const char* e, int commas) {
+    begin = b;
+    end = e;
+    n = scanKernels().findCommas(b, e, comma, min(commas, (int)ColumnMap::kMaxColumns));
+    return n >= commas;
+}
+
+string_view RowFields::operator[](int col) const {
+    if (col < 0 || col > n) return {};
+    uint32_t from = col == 0 ? 0 : comma[col - 1] + 1;
+    uint32_t to;
+    if (col < n) {
+        to = comma[col];
+    } else if (scanKernels().findCommas(begin + from, end, &to, 1) == 1) {
+        to += from;
+    } else {
+        to = (uint32_t)(end - begin);
+    }
+    return string_view(begin + from, to - from);
+}
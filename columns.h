@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+using namespace std;
+
+// Where the trip columns sit in one file, read from its header line.
+// Files whose header does not name at least the pickup zone and pickup
+// time (including headerless files such as SmallTrips.csv, whose first
+// row is skipped unread) keep the standard layout
+//   TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount
+struct ColumnMap {
+    enum Column { kTrip, kPickup, kDropoff, kTime, kDistance, kFare, kColumns };
+    static const int kMaxColumns = 256;
+
+    int index[kColumns] = {0, 1, 2, 3, 4, 5};   // -1 if the file lacks it
+    bool standard = true;
+
+    // Header names are matched case-insensitively, quotes and spaces
+    // trimmed; unknown columns are skipped.
+    static ColumnMap fromHeader(string_view header);
+    static unsigned bit(Column c) { return 1u << c; }
+    // Separators a row must have for the columns in mask to be present:
+    // the standard layout keeps its six-column rule, a mapped one needs
+    // the row to reach its right-most wanted column.
+    int commasFor(unsigned mask) const;
+};
+
+// One row split at its first n separators (RFC 4180 aware). Field
+// col is raw, quotes included; the field just past the last split point
+// runs to the next separator or the end of the row.
+class RowFields {
+public:
+    bool split(const char* b, const char* e, int commas);
+    string_view operator[](int col) const;
+private:
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    int n = 0;
+    uint32_t comma[ColumnMap::kMaxColumns];
+};
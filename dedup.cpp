@@ -0,0 +1,37 @@
+#include "dedup.h"
+using namespace std;
+
+bool TripIdDedup::insert(std::string_view id) {
+    if (id.empty()) return true;   // nothing to key on; never a duplicate
+    // "007" and "7" are different IDs, so leading zeros skip the bitmap.
+    if (id.size() <= (size_t)kMaxDigits && (id.size() == 1 || id[0] != '0')) {
+        uint32_t v = 0;
+        size_t i = 0;
+        for (; i < id.size(); ++i) {
+            unsigned d = (unsigned char)id[i] - '0';
+            if (d > 9) break;
+            v = v * 10 + d;
+        }
+        if (i == id.size()) {
+            size_t page = v >> kPageBits;
+            if (page >= pages.size()) pages.resize(page + 1);
+            if (pages[page].empty()) {
+                pages[page].assign((size_t(1) << kPageBits) / 64, 0);
+                ++pagesUsed;
+            }
+            uint64_t& word = pages[page][(v & ((1u << kPageBits) - 1)) >> 6];
+            uint64_t bit = uint64_t(1) << (v & 63);
+            if (word & bit) return false;
+            word |= bit;
+            return true;
+        }
+    }
+
+    return others.emplace(id).second;
+}
+
+void TripIdDedup::clear() {
+    pages.clear();
+    pagesUsed = 0;
+    others.clear();
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+// Exact TripID membership for duplicate rejection.
+//   - short decimal IDs without a leading zero (the common case) live in a
+//     paged bitmap: one bit per possible ID, 8 KB pages allocated on first
+//     touch;
+//   - anything else goes into an exact string set.
+class TripIdDedup {
+public:
+    // Returns true the first time an ID is seen, false for a duplicate.
+    bool insert(std::string_view id);
+    void clear();
+    size_t bitmapPages() const { return pagesUsed; }
+    size_t exactSetSize() const { return others.size(); }
+
+private:
+    static const int kPageBits = 16;
+    static const int kMaxDigits = 9;          // < 1e9 -> at most 2^14 pages
+
+    vector<vector<uint64_t>> pages;           // empty = page never touched
+    size_t pagesUsed = 0;
+    unordered_set<string> others;
+};
@@ -0,0 +1,50 @@
+#include "groupby.h"
+#include "civiltime.h"
+#include "kernels.h"
+#include <charconv>
+using namespace std;
+
+static double parseNumber(string_view field) {
+    double v = 0;
+    if (from_chars(field.data(), field.data() + field.size(), v).ec != errc()) return 0;
+    return v;
+}
+
+void TripRowDecoder::setHeader(string_view header) {
+    columns = ColumnMap::fromHeader(header);
+    planColumns();
+}
+
+void TripRowDecoder::planColumns() {
+    unsigned need = ColumnMap::bit(ColumnMap::kPickup) | ColumnMap::bit(ColumnMap::kTime);
+    if (fields & kDropoff) need |= ColumnMap::bit(ColumnMap::kDropoff);
+    if (fields & kDistance) need |= ColumnMap::bit(ColumnMap::kDistance);
+    if (fields & kFare) need |= ColumnMap::bit(ColumnMap::kFare);
+    columnCommas = columns.commasFor(need);
+}
+
+bool TripRowDecoder::decode(const char* b, const char* e, TripRow& row) {
+    if (!split.split(b, e, columnCommas)) return false;
+    const int* col = columns.index;
+
+    string scratch;
+    string_view pickup = unquoteField(split[col[ColumnMap::kPickup]], scratch);
+    if (pickup.empty()) return false;
+    string tsScratch;
+    string_view ts = unquoteField(split[col[ColumnMap::kTime]], tsScratch);
+    if (ts.size() < 16) return false;
+    int hour = scanKernels().parseHour(ts.data());
+    if (hour < 0) return false;
+
+    row.pickup = dict.findOrInsert(pickup);
+    row.hour = hour;
+    if (fields & kDropoff) row.dropoff = dict.findOrInsert(unquoteField(split[col[ColumnMap::kDropoff]], scratch));
+    if (fields & kDate) {
+        long long minute = parseEpochMinute(ts);
+        row.day = minute < 0 ? -1 : (int)(minute / 1440);
+        row.weekday = minute < 0 ? -1 : (row.day + 3) % 7;   // 1970-01-01 was a Thursday
+    }
+    if (fields & kDistance) row.distance = parseNumber(unquoteField(split[col[ColumnMap::kDistance]], scratch));
+    if (fields & kFare) row.fare = parseNumber(unquoteField(split[col[ColumnMap::kFare]], scratch));
+    return true;
+}
@@ -0,0 +1,334 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "zonetable.h"
+#include "columns.h"
+using namespace std;
+
+// One decoded trip row as aggregates see it. Zones are already indices
+// into the decoder's dictionary, so aggregation never touches strings.
+struct TripRow {
+    uint32_t pickup = 0, dropoff = 0;
+    int hour = 0;
+    int day = -1;             // days since 1970-01-01; -1 if the date is invalid
+    int weekday = -1;         // 0 = Monday; -1 if the date is invalid
+    double distance = 0, fare = 0;
+};
+
+// Splits trip rows into TripRows, columns located through the file's
+// header (see ColumnMap). Acceptance matches TripAnalyzer: the columns in
+// use present, a non-empty pickup zone and an hour in 00..23. Both zone
+// columns share one dictionary.
+class TripRowDecoder {
+public:
+    // Optional fields; a consumer that needs none of them skips their parsing.
+    enum Field : unsigned { kDropoff = 1, kDate = 2, kDistance = 4, kFare = 8, kAll = 15 };
+    void setFields(unsigned mask) {
+        fields = mask;
+        planColumns();
+    }
+    // Layout of the rows that follow; standard until a header is given.
+    void setHeader(string_view header);
+    bool decode(const char* b, const char* e, TripRow& row);
+    // Decodes every data row of a CSV file into fn(row).
+    template <class Fn>
+    bool scanFile(const string& path, Fn&& fn) {
+        ifstream file(path);
+        if (!file) return false;
+        string line;
+        getline(file, line);
+        setHeader(line);
+        TripRow row;
+        while (getline(file, line))
+            if (decode(line.data(), line.data() + line.size(), row)) fn(row);
+        return true;
+    }
+    const ZoneTable& zones() const { return dict; }
+
+private:
+    void planColumns();
+    ZoneTable dict;
+    unsigned fields = kAll;
+    ColumnMap columns;
+    int columnCommas = ColumnMap::kColumns - 1;
+    RowFields split;
+};
+
+// ---------------- dimensions ----------------
+// A dimension is a fixed-width field of the packed key.
+
+struct PickupZone {
+    static const int kBits = 32;
+    static const bool kZone = true;
+    static bool valid(const TripRow&) { return true; }
+    static uint64_t get(const TripRow& r) { return r.pickup; }
+};
+
+struct DropoffZone {
+    static const int kBits = 32;
+    static const bool kZone = true;
+    static bool valid(const TripRow&) { return true; }
+    static uint64_t get(const TripRow& r) { return r.dropoff; }
+};
+
+struct Hour {
+    static const int kBits = 5;
+    static const bool kZone = false;
+    static bool valid(const TripRow&) { return true; }
+    static uint64_t get(const TripRow& r) { return (uint64_t)r.hour; }
+};
+
+struct Weekday {
+    static const int kBits = 3;
+    static const bool kZone = false;
+    static bool valid(const TripRow& r) { return r.weekday >= 0; }
+    static uint64_t get(const TripRow& r) { return (uint64_t)r.weekday; }
+};
+
+struct Date {
+    static const int kBits = 20;      // days since 1970, good until 4840
+    static const bool kZone = false;
+    static bool valid(const TripRow& r) { return r.day >= 0 && r.day < (1 << 20); }
+    static uint64_t get(const TripRow& r) { return (uint64_t)r.day; }
+};
+
+// ---------------- measures ----------------
+
+struct Count {
+    using Value = long long;
+    static void add(Value& v, const TripRow&) { ++v; }
+};
+
+struct SumFare {
+    using Value = double;
+    static void add(Value& v, const TripRow& r) { v += r.fare; }
+};
+
+struct SumDistance {
+    using Value = double;
+    static void add(Value& v, const TripRow& r) { v += r.distance; }
+};
+
+// ---------------- packed keys ----------------
+
+// Hash of a packed key, folded to 64 bits for 128-bit keys.
+template <class Packed>
+inline uint64_t hashPacked(Packed k) {
+    uint64_t h = uint64_t(k);
+    if constexpr (sizeof(Packed) > 8) h ^= uint64_t(k >> 64) * 0x9e3779b97f4a7c15ULL;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// Key layout for a list of dimensions: the first dimension in the high
+// bits, packed into the narrowest of 32, 64 or 128 bits that fits.
+template <class... Dims>
+struct Keys {
+    static constexpr int kCount = (int)sizeof...(Dims);
+    static constexpr int kBits = (Dims::kBits + ... + 0);
+    static_assert(kCount > 0 && kBits <= 128, "1..128 key bits");
+    using Packed = conditional_t<(kBits <= 32), uint32_t,
+                   conditional_t<(kBits <= 64), uint64_t, unsigned __int128>>;
+    template <size_t I>
+    using Dim = tuple_element_t<I, tuple<Dims...>>;
+
+    static constexpr int kWidth[] = {Dims::kBits...};
+    static constexpr int offset(size_t i) {
+        int s = 0;
+        for (size_t j = i + 1; j < sizeof...(Dims); ++j) s += kWidth[j];
+        return s;
+    }
+
+    static bool valid(const TripRow& r) { return (Dims::valid(r) && ...); }
+    static Packed pack(const TripRow& r) { return pack(r, index_sequence_for<Dims...>{}); }
+
+    template <size_t I>
+    static uint64_t field(Packed k) {
+        const int w = Dim<I>::kBits;
+        uint64_t v = uint64_t(k >> offset(I));
+        return w >= 64 ? v : v & ((uint64_t(1) << w) - 1);
+    }
+
+    static uint64_t hash(Packed k) { return hashPacked(k); }
+
+    // Field-by-field order: zone fields by name, the others numerically.
+    static int compare(Packed a, Packed b, const ZoneTable& names) {
+        return compare(a, b, names, index_sequence_for<Dims...>{});
+    }
+
+private:
+    template <size_t... I>
+    static Packed pack(const TripRow& r, index_sequence<I...>) {
+        Packed k = 0;
+        ((k |= Packed(Dims::get(r)) << offset(I)), ...);
+        return k;
+    }
+    template <size_t... I>
+    static int compare(Packed a, Packed b, const ZoneTable& names, index_sequence<I...>) {
+        int c = 0;
+        ((c = c ? c : compareField<I>(a, b, names)), ...);
+        return c;
+    }
+    template <size_t I>
+    static int compareField(Packed a, Packed b, const ZoneTable& names) {
+        uint64_t x = field<I>(a), y = field<I>(b);
+        if (x == y) return 0;
+        if constexpr (Dim<I>::kZone) return names.name((uint32_t)x) < names.name((uint32_t)y) ? -1 : 1;
+        else return x < y ? -1 : 1;
+    }
+};
+
+// ---------------- aggregation ----------------
+
+// Group-by over a compile-time key layout and measure list, e.g.
+//   GroupBy<Keys<PickupZone, Hour>, Count>
+//   GroupBy<Keys<DropoffZone, Weekday>, Count, SumFare>
+// Groups live in one open-addressing table over packed keys, so add() is
+// a pack, a multiply-shift hash and a linear probe with no branches on
+// the layout. Rows whose key fields are invalid (e.g. no date) are skipped.
+//
+// TripAnalyzer::topZones and topBusySlots are the Keys<PickupZone> and
+// Keys<PickupZone, Hour> Count questions. Their state stays in the dense
+// zone-indexed tables that snapshots, spill runs and the zone catalog work
+// on; the groups they gather from it are ranked by selectTop below.
+// QueryPlan (--aggregate) runs its queries on the table itself.
+template <class KeySpec, class... Measures>
+class GroupBy {
+public:
+    static_assert(sizeof...(Measures) > 0, "at least one measure");
+    using Key = typename KeySpec::Packed;
+    using Values = tuple<typename Measures::Value...>;
+    struct Group {
+        Key key;
+        Values values;
+    };
+
+    void add(const TripRow& r) {
+        if (KeySpec::valid(r)) addKey(KeySpec::pack(r), r);
+    }
+    // For key layouts known only at run time (see QueryPlan).
+    void addKey(Key k, const TripRow& r) {
+        addMeasures(find(k), r, index_sequence_for<Measures...>{});
+    }
+
+    // other must have been fed by the same decoder (same zone indices).
+    void merge(const GroupBy& other) {
+        other.forEach([this](Key k, const Values& v) {
+            mergeValues(find(k), v, index_sequence_for<Measures...>{});
+        });
+    }
+
+    size_t size() const { return count; }
+    void clear() {
+        keys.clear();
+        values.clear();
+        used.clear();
+        mask = 0;
+        count = 0;
+    }
+
+    template <class Fn>
+    void forEach(Fn fn) const {
+        for (size_t i = 0; i < used.size(); ++i)
+            if (used[i]) fn(keys[i], values[i]);
+    }
+
+    template <size_t I>
+    static uint64_t field(Key k) { return KeySpec::template field<I>(k); }
+
+    // The k groups with the largest measure M; ties go to the smaller key
+    // (zone fields by name). TripAnalyzer's built-in queries rank by it too.
+    template <size_t M = 0>
+    vector<Group> top(int k, const ZoneTable& names) const {
+        vector<Group> result;
+        result.reserve(count);
+        forEach([&result](Key key, const Values& v) { result.push_back({key, v}); });
+        selectTop<M>(result, k, names);
+        return result;
+    }
+
+    // top()'s order over groups gathered elsewhere, names resolving their
+    // zone fields.
+    template <size_t M = 0>
+    static auto before(const ZoneTable& names) {
+        return [&names](const Group& a, const Group& b) {
+            if (get<M>(a.values) != get<M>(b.values)) return get<M>(a.values) > get<M>(b.values);
+            return KeySpec::compare(a.key, b.key, names) < 0;
+        };
+    }
+
+    // Cuts groups down to its k best in that order. selected() runs once
+    // they are chosen, before they are sorted.
+    template <size_t M = 0, class Fn>
+    static void selectTop(vector<Group>& groups, int k, const ZoneTable& names, Fn selected) {
+        if (k <= 0) {
+            groups.clear();
+            return;
+        }
+        auto order = before<M>(names);
+        size_t kk = min(groups.size(), (size_t)k);
+        nth_element(groups.begin(), groups.begin() + kk, groups.end(), order);
+        selected();
+        sort(groups.begin(), groups.begin() + kk, order);
+        groups.resize(kk);
+    }
+    template <size_t M = 0>
+    static void selectTop(vector<Group>& groups, int k, const ZoneTable& names) {
+        selectTop<M>(groups, k, names, [] {});
+    }
+
+private:
+    Values& find(Key k) {
+        if ((count + 1) * 2 > used.size()) grow();
+        size_t pos = KeySpec::hash(k) & mask;
+        while (used[pos] && keys[pos] != k) pos = (pos + 1) & mask;
+        if (!used[pos]) {
+            used[pos] = 1;
+            keys[pos] = k;
+            values[pos] = Values();
+            ++count;
+        }
+        return values[pos];
+    }
+
+    void grow() {
+        size_t cap = used.empty() ? 64 : used.size() * 2;
+        vector<Key> oldKeys(cap);
+        vector<Values> oldValues(cap);
+        vector<uint8_t> oldUsed(cap, 0);
+        oldKeys.swap(keys);
+        oldValues.swap(values);
+        oldUsed.swap(used);
+        mask = cap - 1;
+        for (size_t i = 0; i < oldUsed.size(); ++i) {
+            if (!oldUsed[i]) continue;
+            size_t pos = KeySpec::hash(oldKeys[i]) & mask;
+            while (used[pos]) pos = (pos + 1) & mask;
+            used[pos] = 1;
+            keys[pos] = oldKeys[i];
+            values[pos] = oldValues[i];
+        }
+    }
+
+    template <size_t... I>
+    static void addMeasures(Values& v, const TripRow& r, index_sequence<I...>) {
+        (Measures::add(get<I>(v), r), ...);
+    }
+    template <size_t... I>
+    static void mergeValues(Values& v, const Values& o, index_sequence<I...>) {
+        ((get<I>(v) += get<I>(o)), ...);
+    }
+
+    vector<Key> keys;
+    vector<Values> values;
+    vector<uint8_t> used;
+    size_t mask = 0;
+    size_t count = 0;
+};
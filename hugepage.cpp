@@ -0,0 +1,89 @@
+#include "hugepage.h"
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <sys/mman.h>
+using namespace std;
+
+static const size_t kHugePage = size_t(2) << 20;
+static const size_t kSmallPage = 4096;
+
+namespace {
+enum class Backing { Regular, Transparent, Explicit };
+struct Mapping {
+    Backing backing;
+    size_t length;
+};
+// Large blocks are few (vector doublings), so a locked side table is cheap.
+mutex registryLock;
+unordered_map<void*, Mapping> registry;
+HugePageUsage usage;
+}
+
+static size_t roundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+static void remember(void* p, Backing b, size_t length) {
+    lock_guard<mutex> g(registryLock);
+    registry[p] = Mapping{b, length};
+    if (b == Backing::Explicit) usage.explicitBytes += length;
+    else if (b == Backing::Transparent) usage.transparentBytes += length;
+    else usage.regularBytes += length;
+}
+
+// 2 MB-aligned anonymous mapping: over-map by one huge page, trim the ends.
+static void* mapAligned(size_t length) {
+    size_t span = length + kHugePage;
+    void* raw = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return nullptr;
+    uintptr_t start = (uintptr_t)raw, aligned = roundUp(start, kHugePage);
+    if (aligned > start) munmap(raw, aligned - start);
+    size_t tail = (start + span) - (aligned + length);
+    if (tail) munmap((void*)(aligned + length), tail);
+    return (void*)aligned;
+}
+
+void* hugePageMap(size_t bytes, HugePagePolicy policy) {
+    if (policy == HugePagePolicy::Explicit) {
+        size_t length = roundUp(bytes, kHugePage);
+        void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            remember(p, Backing::Explicit, length);
+            return p;
+        }
+        policy = HugePagePolicy::Transparent;
+    }
+    if (policy == HugePagePolicy::Transparent) {
+        size_t length = roundUp(bytes, kHugePage);
+        if (void* p = mapAligned(length)) {
+            bool thp = madvise(p, length, MADV_HUGEPAGE) == 0;
+            remember(p, thp ? Backing::Transparent : Backing::Regular, length);
+            return p;
+        }
+    }
+    size_t length = roundUp(bytes, kSmallPage);
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) throw std::bad_alloc();
+    remember(p, Backing::Regular, length);
+    return p;
+}
+
+void hugePageUnmap(void* p, size_t) {
+    Mapping m;
+    {
+        lock_guard<mutex> g(registryLock);
+        auto it = registry.find(p);
+        if (it == registry.end()) return;
+        m = it->second;
+        registry.erase(it);
+        if (m.backing == Backing::Explicit) usage.explicitBytes -= m.length;
+        else if (m.backing == Backing::Transparent) usage.transparentBytes -= m.length;
+        else usage.regularBytes -= m.length;
+    }
+    munmap(p, m.length);
+}
+
+HugePageUsage hugePageUsage() {
+    lock_guard<mutex> g(registryLock);
+    return usage;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+using namespace std;
+
+// Backing for the large analyzer tables (counter matrix, zone hash table).
+//   Off:         plain anonymous mappings
+//   Transparent: 2 MB-aligned mappings with madvise(MADV_HUGEPAGE)
+//   Explicit:    MAP_HUGETLB from the reserved pool, falling back to
+//                Transparent when the pool is empty or not configured
+enum class HugePagePolicy { Off, Transparent, Explicit };
+
+// Live bytes per backing actually obtained, for reporting.
+struct HugePageUsage {
+    size_t explicitBytes = 0;
+    size_t transparentBytes = 0;
+    size_t regularBytes = 0;
+};
+HugePageUsage hugePageUsage();
+
+// Under Transparent or Explicit, blocks of at least kMapThreshold bytes
+// are mmapped directly; everything else, and every block under Off, uses
+// operator new. The policy is carried by the allocator instance, so two
+// allocators are equal only if their policies are, and containers take
+// the allocator along when they are assigned or swapped.
+void* hugePageMap(size_t bytes, HugePagePolicy policy);
+void hugePageUnmap(void* p, size_t bytes);
+const size_t kMapThreshold = size_t(1) << 20;
+
+template <class T>
+struct HugePageAllocator {
+    using value_type = T;
+    using is_always_equal = std::false_type;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    HugePagePolicy policy = HugePagePolicy::Off;
+
+    HugePageAllocator() = default;
+    explicit HugePageAllocator(HugePagePolicy p) : policy(p) {}
+    template <class U> HugePageAllocator(const HugePageAllocator<U>& o) : policy(o.policy) {}
+
+    bool mapped(size_t bytes) const { return policy != HugePagePolicy::Off && bytes >= kMapThreshold; }
+    T* allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (mapped(bytes)) return static_cast<T*>(hugePageMap(bytes, policy));
+        return static_cast<T*>(::operator new(bytes));
+    }
+    void deallocate(T* p, size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (mapped(bytes)) hugePageUnmap(p, bytes);
+        else ::operator delete(p);
+    }
+    template <class U> bool operator==(const HugePageAllocator<U>& o) const { return policy == o.policy; }
+    template <class U> bool operator!=(const HugePageAllocator<U>& o) const { return policy != o.policy; }
+};
+
+template <class T>
+using HugeVector = vector<T, HugePageAllocator<T>>;
@@ -0,0 +1,238 @@
+#include "kernels.h"
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <initializer_list>
+#include <string>
+using namespace std;
+
+// The SIMD variants finish a row with one more vector load when that load
+// cannot cross into the next page, masking off the bytes past the end;
+// otherwise the tail is scanned byte by byte.
+static inline bool safeOverread(const char* p, size_t width) {
+    return ((uintptr_t)p & 4095) <= 4096 - width;
+}
+
+// Collects set bits of a comparison mask as offsets.
+static inline int drainMask(uint64_t mask, uint32_t base, uint32_t* out, int n, int maxCount) {
+    while (mask && n < maxCount) {
+        out[n++] = base + (uint32_t)__builtin_ctzll(mask);
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+// RFC 4180 quoting: a comma between an opening and a closing '"' is
+// data. A doubled quote inside a quoted field toggles twice, so one bit
+// of quote parity carried from block to block is all the state needed.
+static inline int scalarTail(const char* b, const char* p, const char* e,
+                             uint32_t* out, int n, int maxCount, bool quoted) {
+    for (; p < e && n < maxCount; ++p) {
+        if (*p == '"') quoted = !quoted;
+        else if (*p == ',' && !quoted) out[n++] = (uint32_t)(p - b);
+    }
+    return n;
+}
+
+// Bit i of the result: parity of the quotes at or below bit i, i.e. "byte
+// i is inside quotes" (the simdjson quote mask, without the carry-less
+// multiply). carry is all ones when the block starts inside quotes; it is
+// updated from the block's top bit.
+static inline uint64_t insideQuotes(uint64_t quotes, uint64_t& carry, int width) {
+    uint64_t x = quotes;
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    x ^= carry;
+    carry = uint64_t(0) - ((x >> (width - 1)) & 1);
+    return x;
+}
+
+// ---------------- scalar ----------------
+
+static int findCommasScalar(const char* b, const char* e, uint32_t* out, int maxCount) {
+    return scalarTail(b, b, e, out, 0, maxCount, false);
+}
+
+static const char* findNewlineScalar(const char* p, const char* end) {
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    return nl ? nl : end;
+}
+
+static int parseHourScalar(const char* ts) {
+    unsigned hi = (unsigned char)ts[11] - '0', lo = (unsigned char)ts[12] - '0';
+    if (hi > 9 || lo > 9) return -1;
+    int h = (int)(hi * 10 + lo);
+    return h < 24 ? h : -1;
+}
+
+// Both bytes checked for '0'..'9' at once, no per-character branch: a
+// byte is a digit iff its high nibble is 3 both before and after adding 6.
+// Two bytes are too few for vector registers to help, so every SIMD
+// variant shares this one; scalar keeps the per-byte form as a baseline.
+static int parseHourSwar(const char* ts) {
+    uint16_t v;
+    memcpy(&v, ts + 11, 2);
+    unsigned bad = ((v & 0xF0F0u) ^ 0x3030u) | (((v + 0x0606u) & 0xF0F0u) ^ 0x3030u);
+    unsigned d = v & 0x0F0Fu;
+    int h = (int)((d & 0xff) * 10 + (d >> 8));
+    return (bad == 0 && h < 24) ? h : -1;
+}
+
+// ---------------- SSE4.2 ----------------
+
+__attribute__((target("sse4.2")))
+static int findCommasSse42(const char* b, const char* e, uint32_t* out, int maxCount) {
+    const __m128i comma = _mm_set1_epi8(','), quote = _mm_set1_epi8('"');
+    const char* p = b;
+    int n = 0;
+    uint64_t carry = 0;
+    for (; p + 16 <= e && n < maxCount; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        uint64_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma));
+        uint64_t q = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote));
+        if (__builtin_expect(q | carry, 0)) m &= ~insideQuotes(q, carry, 16);
+        n = drainMask(m, (uint32_t)(p - b), out, n, maxCount);
+    }
+    if (p < e && n < maxCount) {
+        if (!safeOverread(p, 16)) return scalarTail(b, p, e, out, n, maxCount, carry != 0);
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        uint64_t live = (uint64_t(1) << (e - p)) - 1;
+        uint64_t m = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) & live;
+        uint64_t q = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) & live;
+        if (q | carry) m &= ~insideQuotes(q, carry, 16);
+        n = drainMask(m, (uint32_t)(p - b), out, n, maxCount);
+    }
+    return n;
+}
+
+__attribute__((target("sse4.2")))
+static const char* findNewlineSse42(const char* p, const char* end) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16) {
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+        if (m) return p + __builtin_ctz(m);
+    }
+    for (; p < end; ++p)
+        if (*p == '\n') return p;
+    return end;
+}
+
+// ---------------- AVX2 ----------------
+
+__attribute__((target("avx2")))
+static int findCommasAvx2(const char* b, const char* e, uint32_t* out, int maxCount) {
+    const __m256i comma = _mm256_set1_epi8(','), quote = _mm256_set1_epi8('"');
+    const char* p = b;
+    int n = 0;
+    uint64_t carry = 0;
+    for (; p + 32 <= e && n < maxCount; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma));
+        uint64_t q = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote));
+        if (__builtin_expect(q | carry, 0)) m &= ~insideQuotes(q, carry, 32);
+        n = drainMask(m, (uint32_t)(p - b), out, n, maxCount);
+    }
+    if (p < e && n < maxCount) {
+        if (!safeOverread(p, 32)) return scalarTail(b, p, e, out, n, maxCount, carry != 0);
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        uint64_t live = (uint64_t(1) << (e - p)) - 1;
+        uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, comma)) & live;
+        uint64_t q = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) & live;
+        if (q | carry) m &= ~insideQuotes(q, carry, 32);
+        n = drainMask(m, (uint32_t)(p - b), out, n, maxCount);
+    }
+    return n;
+}
+
+__attribute__((target("avx2")))
+static const char* findNewlineAvx2(const char* p, const char* end) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; p + 32 <= end; p += 32) {
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), nl));
+        if (m) return p + __builtin_ctz(m);
+    }
+    for (; p < end; ++p)
+        if (*p == '\n') return p;
+    return end;
+}
+
+// ---------------- AVX-512 (BW) ----------------
+// Masked loads never fault on masked-off bytes, so tails need no special case.
+
+__attribute__((target("avx512f,avx512bw,bmi2")))
+static int findCommasAvx512(const char* b, const char* e, uint32_t* out, int maxCount) {
+    const __m512i comma = _mm512_set1_epi8(','), quote = _mm512_set1_epi8('"');
+    int n = 0;
+    uint64_t carry = 0;
+    for (const char* p = b; p < e && n < maxCount; p += 64) {
+        size_t left = (size_t)(e - p);
+        __mmask64 live = left >= 64 ? ~__mmask64(0) : _bzhi_u64(~0ULL, (unsigned)left);
+        __m512i v = _mm512_maskz_loadu_epi8(live, p);
+        uint64_t m = _mm512_mask_cmpeq_epi8_mask(live, v, comma);
+        uint64_t q = _mm512_mask_cmpeq_epi8_mask(live, v, quote);
+        if (__builtin_expect(q | carry, 0)) m &= ~insideQuotes(q, carry, 64);
+        n = drainMask(m, (uint32_t)(p - b), out, n, maxCount);
+    }
+    return n;
+}
+
+__attribute__((target("avx512f,avx512bw,bmi2")))
+static const char* findNewlineAvx512(const char* p, const char* end) {
+    const __m512i nl = _mm512_set1_epi8('\n');
+    for (; p < end; p += 64) {
+        size_t left = (size_t)(end - p);
+        __mmask64 live = left >= 64 ? ~__mmask64(0) : _bzhi_u64(~0ULL, (unsigned)left);
+        uint64_t m = _mm512_mask_cmpeq_epi8_mask(live, _mm512_maskz_loadu_epi8(live, p), nl);
+        if (m) return p + __builtin_ctzll(m);
+    }
+    return end;
+}
+
+// ---------------- fields ----------------
+
+string_view unquoteField(string_view field, string& scratch) {
+    if (field.size() < 2 || field.front() != '"' || field.back() != '"') return field;
+    field = field.substr(1, field.size() - 2);
+    size_t q = field.find('"');
+    if (q == string_view::npos) return field;
+    scratch.assign(field.data(), q);
+    for (size_t i = q; i < field.size(); ++i) {
+        scratch.push_back(field[i]);
+        if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"') ++i;
+    }
+    return scratch;
+}
+
+// ---------------- dispatch ----------------
+
+static const ScanKernels kScalar = {"scalar", findCommasScalar, findNewlineScalar, parseHourScalar};
+static const ScanKernels kSse42 = {"sse42", findCommasSse42, findNewlineSse42, parseHourSwar};
+static const ScanKernels kAvx2 = {"avx2", findCommasAvx2, findNewlineAvx2, parseHourSwar};
+static const ScanKernels kAvx512 = {"avx512", findCommasAvx512, findNewlineAvx512, parseHourSwar};
+
+const ScanKernels* kernelsByName(const char* name) {
+    __builtin_cpu_init();
+    if (!strcmp(name, "scalar")) return &kScalar;
+    if (!strcmp(name, "sse42")) return __builtin_cpu_supports("sse4.2") ? &kSse42 : nullptr;
+    if (!strcmp(name, "avx2")) return __builtin_cpu_supports("avx2") ? &kAvx2 : nullptr;
+    if (!strcmp(name, "avx512"))
+        return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("bmi2") ? &kAvx512 : nullptr;
+    return nullptr;
+}
+
+static const ScanKernels& selectKernels() {
+    if (const char* forced = getenv("TRIP_ISA"))
+        if (const ScanKernels* k = kernelsByName(forced)) return *k;
+    for (const char* name : {"avx512", "avx2", "sse42"})
+        if (const ScanKernels* k = kernelsByName(name)) return *k;
+    return kScalar;
+}
+
+const ScanKernels& scanKernels() {
+    static const ScanKernels& chosen = selectKernels();
+    return chosen;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+using namespace std;
+
+// Row-scanning kernels behind ingest, compiled once per ISA and picked at
+// startup from cpuid. TRIP_ISA=scalar|sse42|avx2|avx512 forces a variant
+// (ignored if this CPU lacks it) so variants can be compared on one host.
+struct ScanKernels {
+    const char* name;
+    // Offsets of the first maxCount separator commas of [b, e), skipping
+    // commas inside RFC 4180 quoted fields; returns how many.
+    int (*findCommas)(const char* b, const char* e, uint32_t* out, int maxCount);
+    // First '\n' in [p, end), or end.
+    const char* (*findNewline)(const char* p, const char* end);
+    // Hour of a "YYYY-MM-DD HH:MM" value (ts[11..12]); -1 unless 00..23.
+    // One SWAR routine serves every SIMD variant.
+    int (*parseHour)(const char* ts);
+};
+
+const ScanKernels& scanKernels();               // selected once, thread-safe
+const ScanKernels* kernelsByName(const char* name);   // nullptr if unsupported
+
+// A field with its RFC 4180 quotes removed; doubled quotes inside are
+// collapsed into scratch, which the result then views. Unquoted fields
+// come back unchanged.
+string_view unquoteField(string_view field, string& scratch);
@@ -1,31 +1,435 @@
 #include "analyzer.h"
+#include "output.h"
+#include "queryplan.h"
+#include "window.h"
 #include <iostream>
+#include <algorithm>
 #include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <glob.h>
+#include <unistd.h>
 
-static void printZones(const std::vector<ZoneCount>& v) {
-    std::cout << "TOP_ZONES\n";
-    for (auto& x : v)
-        std::cout << x.zone << "," << x.count << "\n";
+static const char* kUsage =
+    "usage: app [options] [FILE|GLOB ...]      (default input: SmallTrips.csv)\n"
+    "  -k N                 top-k for both queries (default 10)\n"
+    "  --zones-k N          top-k for TOP_ZONES only\n"
+    "  --slots-k N          top-k for TOP_SLOTS only\n"
+    "  --all                return every zone and every slot\n"
+    "  --threads N          parallel ingest across files / mmap ranges\n"
+    "  --mode MODE          exact | approx counting\n"
+    "  --reader R           getline | mmap | stream | async file reading;\n"
+    "                       --mode mmap|stream|async still works as --reader\n"
+    "  --io-depth N         async: reads in flight per file (default 4)\n"
+    "  --io-backend B       async: auto | uring | threads (pread pool)\n"
+    "  --format FMT         text | csv | jsonl | binary\n"
+    "  --export FMT         same as --all --format FMT\n"
+    "  --hugepages KIND     off | thp | explicit backing for the counter tables\n"
+    "  --dedup              drop rows whose TripID was already seen\n"
+    "  --strict-time        reject rows whose whole pickup time is not valid\n"
+    "  --zone-catalog FILE  known zone IDs, one per line (perfect-hash lookup)\n"
+    "  --unknown-zones P    fallback | reject zones missing from the catalog\n"
+    "  --memory-budget MB   cap the exact tables; spill sorted runs to disk\n"
+    "  --spill-dir DIR      where spilled runs go (default $TMPDIR or /tmp)\n"
+    "  --window MINUTES     top-k over the last MINUTES of pickup time only\n"
+    "  --aggregate SPEC     dims:measure[:k], e.g. dropoff,weekday:fare:5;\n"
+    "                       repeatable, all answered in one scan\n"
+    "                       (--window and --aggregate take only -k, --format\n"
+    "                       and --stats; --aggregate has no -k either)\n"
+    "  --quarantine FILE    write rejected rows with reason and byte offset\n"
+    "  --quarantine-every N keep every Nth rejected row (default 1)\n"
+    "  --quarantine-max N   stop after N quarantined rows\n"
+    "  --checkpoint FILE    save progress to FILE and resume from it; Ctrl-C\n"
+    "                       stops at the next checkpoint (exact counting on\n"
+    "                       one thread; not with --dedup or --memory-budget)\n"
+    "  --checkpoint-every N MB of input between checkpoints (default 256)\n"
+    "  --save-snapshot PATH write the exact state for snapmerge\n"
+    "  --stats              print ingest counters and timings to stderr\n"
+    "  --profile            add hardware counters per phase to --stats\n";
+
+struct Options {
+    std::vector<std::string> inputs;
+    int zonesK = 10, slotsK = 10;
+    int threads = 1;
+    IngestMode mode = IngestMode::Exact;
+    ReadMode reader = ReadMode::Getline;
+    OutputFormat format = OutputFormat::Text;
+    HugePagePolicy hugePages = HugePagePolicy::Off;
+    bool dedup = false;
+    bool strictTime = false;
+    std::string zoneCatalog;
+    UnknownZonePolicy unknownZones = UnknownZonePolicy::Fallback;
+    bool stats = false;
+    bool profile = false;
+    std::string snapshotOut;
+    int memoryBudgetMb = 0;
+    int windowMinutes = 0;
+    std::vector<std::string> aggregates;
+    std::string quarantine;
+    int quarantineEvery = 1;
+    int quarantineMax = -1;
+    std::string spillDir;
+    int ioDepth = AsyncFileReader::kDefaultDepth;
+    AsyncFileReader::Backend ioBackend = AsyncFileReader::Backend::Auto;
+    std::string checkpoint;
+    int checkpointEveryMb = 256;
+    std::vector<std::string> given;    // option names, in order
+};
+
+// Options read only by the TripAnalyzer ingest. --window and --aggregate
+// scan the inputs on their own, so they refuse these instead of ignoring
+// them.
+static const char* const kIngestOptions[] = {
+    "--threads", "--mode", "--reader", "--io-depth", "--io-backend", "--hugepages", "--dedup",
+    "--strict-time", "--zone-catalog", "--unknown-zones", "--memory-budget", "--spill-dir",
+    "--quarantine", "--quarantine-every", "--quarantine-max", "--checkpoint", "--checkpoint-every",
+    "--save-snapshot", "--profile"};
+// Top-k options; an --aggregate spec carries its own k.
+static const char* const kTopKOptions[] = {"-k", "--zones-k", "--slots-k", "--all"};
+
+template <size_t N>
+static const char* firstGiven(const Options& o, const char* const (&names)[N]) {
+    for (const auto& g : o.given)
+        for (const char* n : names)
+            if (g == n) return n;
+    return nullptr;
+}
+
+static bool parseCount(const char* s, int& out) {
+    char* end = nullptr;
+    long v = std::strtol(s, &end, 10);
+    if (end == s || *end != '\0' || v < 0) return false;
+    out = v > INT_MAX ? INT_MAX : (int)v;
+    return true;
+}
+
+static bool parseReader(const std::string& s, ReadMode& r) {
+    if (s == "getline") r = ReadMode::Getline;
+    else if (s == "mmap") r = ReadMode::Mmap;
+    else if (s == "stream") r = ReadMode::Stream;
+    else if (s == "async") r = ReadMode::Async;
+    else return false;
+    return true;
+}
+
+// --mode picks the counting; the reader names it used to take still work
+// and set only the reader.
+static bool parseMode(const std::string& s, Options& o) {
+    if (s == "exact") o.mode = IngestMode::Exact;
+    else if (s == "approx") o.mode = IngestMode::Sketch;
+    else return parseReader(s, o.reader);
+    return true;
 }
 
-static void printSlots(const std::vector<SlotCount>& v) {
-    std::cout << "TOP_SLOTS\n";
-    for (auto& x : v)
-        std::cout << x.zone << "," << x.hour << "," << x.count << "\n";
+// Patterns without a match are kept verbatim, so a missing file still
+// behaves like ingestFile on a missing path (empty result).
+static void expandGlob(const char* pattern, std::vector<std::string>& out) {
+    glob_t g;
+    if (glob(pattern, GLOB_NOCHECK, nullptr, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; ++i) out.push_back(g.gl_pathv[i]);
+    }
+    globfree(&g);
 }
 
-int main() {
+static bool parseHugePages(const std::string& s, HugePagePolicy& p) {
+    if (s == "off") p = HugePagePolicy::Off;
+    else if (s == "thp" || s == "transparent") p = HugePagePolicy::Transparent;
+    else if (s == "explicit") p = HugePagePolicy::Explicit;
+    else return false;
+    return true;
+}
+
+static bool parseIoBackend(const std::string& s, AsyncFileReader::Backend& b) {
+    if (s == "auto") b = AsyncFileReader::Backend::Auto;
+    else if (s == "uring" || s == "io_uring") b = AsyncFileReader::Backend::IoUring;
+    else if (s == "threads") b = AsyncFileReader::Backend::Threads;
+    else return false;
+    return true;
+}
+
+static bool parseUnknownZones(const std::string& s, UnknownZonePolicy& p) {
+    if (s == "fallback") p = UnknownZonePolicy::Fallback;
+    else if (s == "reject") p = UnknownZonePolicy::Reject;
+    else return false;
+    return true;
+}
+
+static int parseArgs(int argc, char** argv, Options& o) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto value = [&](const char*& v) {
+            if (i + 1 >= argc) return false;
+            v = argv[++i];
+            return true;
+        };
+        const char* v = nullptr;
+        bool ok = true;
+        if (a == "-h" || a == "--help") { std::cout << kUsage; return 0; }
+        else if (a == "-k") { int k = 0; ok = value(v) && parseCount(v, k); o.zonesK = o.slotsK = k; }
+        else if (a == "--zones-k") ok = value(v) && parseCount(v, o.zonesK);
+        else if (a == "--slots-k") ok = value(v) && parseCount(v, o.slotsK);
+        else if (a == "--all") o.zonesK = o.slotsK = INT_MAX;
+        else if (a == "--threads") ok = value(v) && parseCount(v, o.threads);
+        else if (a == "--mode") ok = value(v) && parseMode(v, o);
+        else if (a == "--reader") ok = value(v) && parseReader(v, o.reader);
+        else if (a == "--format") ok = value(v) && parseOutputFormat(v, o.format);
+        else if (a == "--export") {
+            ok = value(v) && parseOutputFormat(v, o.format);
+            o.zonesK = o.slotsK = INT_MAX;
+        }
+        else if (a == "--hugepages") ok = value(v) && parseHugePages(v, o.hugePages);
+        else if (a == "--dedup") o.dedup = true;
+        else if (a == "--strict-time") o.strictTime = true;
+        else if (a == "--zone-catalog") { ok = value(v); if (ok) o.zoneCatalog = v; }
+        else if (a == "--unknown-zones") ok = value(v) && parseUnknownZones(v, o.unknownZones);
+        else if (a == "--memory-budget") ok = value(v) && parseCount(v, o.memoryBudgetMb);
+        else if (a == "--spill-dir") { ok = value(v); if (ok) o.spillDir = v; }
+        else if (a == "--window") ok = value(v) && parseCount(v, o.windowMinutes);
+        else if (a == "--aggregate") {
+            AggregateSpec spec;
+            ok = value(v) && parseAggregateSpec(v, spec);
+            if (ok) o.aggregates.push_back(v);
+        }
+        else if (a == "--quarantine") { ok = value(v); if (ok) o.quarantine = v; }
+        else if (a == "--quarantine-every") ok = value(v) && parseCount(v, o.quarantineEvery);
+        else if (a == "--quarantine-max") ok = value(v) && parseCount(v, o.quarantineMax);
+        else if (a == "--io-depth") ok = value(v) && parseCount(v, o.ioDepth);
+        else if (a == "--io-backend") ok = value(v) && parseIoBackend(v, o.ioBackend);
+        else if (a == "--checkpoint") { ok = value(v); if (ok) o.checkpoint = v; }
+        else if (a == "--checkpoint-every") ok = value(v) && parseCount(v, o.checkpointEveryMb);
+        else if (a == "--save-snapshot") { ok = value(v); if (ok) o.snapshotOut = v; }
+        else if (a == "--stats") o.stats = true;
+        else if (a == "--profile") o.stats = o.profile = true;
+        else if (!a.empty() && a[0] == '-') ok = false;
+        else expandGlob(argv[i], o.inputs);
+        if (!ok) {
+            std::cerr << "app: bad argument near '" << a << "'\n" << kUsage;
+            return 2;
+        }
+        if (a[0] == '-') o.given.push_back(a);
+    }
+    if (o.inputs.empty()) o.inputs.push_back("SmallTrips.csv");
+
+    // Options the chosen path would not read are errors, not no-ops.
+    const char* path = o.windowMinutes > 0 ? "--window" : !o.aggregates.empty() ? "--aggregate" : nullptr;
+    if (path) {
+        const char* unused = firstGiven(o, kIngestOptions);
+        if (!unused && o.windowMinutes > 0 && !o.aggregates.empty()) unused = "--aggregate";
+        if (!unused && o.windowMinutes == 0) unused = firstGiven(o, kTopKOptions);
+        if (unused) {
+            std::cerr << "app: " << unused << " does not apply with " << path << "\n";
+            return 2;
+        }
+    } else if (o.reader != ReadMode::Async) {
+        static const char* const kAsyncOptions[] = {"--io-depth", "--io-backend"};
+        if (const char* unused = firstGiven(o, kAsyncOptions)) {
+            std::cerr << "app: " << unused << " needs --reader async\n";
+            return 2;
+        }
+    }
+    // A checkpointed ingest is exact, without dedup, on one thread, and
+    // keeps its whole state in memory.
+    if (!o.checkpoint.empty()) {
+        const char* clash = o.dedup ? "--dedup" : o.mode != IngestMode::Exact ? "--mode approx"
+                          : o.threads > 1 ? "--threads" : o.memoryBudgetMb > 0 ? "--memory-budget" : nullptr;
+        if (clash) {
+            std::cerr << "app: " << clash << " does not apply with --checkpoint\n";
+            return 2;
+        }
+    }
+    return -1;
+}
+
+// Streams the inputs in order through a sliding window and reports the
+// window ending at the newest pickup time.
+static int runWindow(const Options& opt) {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    WindowAnalyzer window(opt.windowMinutes);
+    for (const auto& path : opt.inputs) window.ingestFile(path);
+
+    OutputBuffer out;
+    formatZones(out, window.topZones(opt.zonesK), opt.format);
+    formatSlots(out, window.topBusySlots(opt.slotsK), opt.format);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - t0).count();
+    if (opt.format == OutputFormat::Text) {
+        out.put("EXEC_MS\n");
+        out.putInt(ms);
+        out.put('\n');
+    }
+    bool ok = out.flush(STDOUT_FILENO);
+    if (opt.stats) {
+        OutputBuffer err(256);
+        err.put("window_rows=");
+        err.putInt(window.rowsInWindow());
+        err.put("\nlate=");
+        err.putInt(window.rowsLate());
+        err.put("\nmalformed=");
+        err.putInt(window.rowsMalformed());
+        err.put('\n');
+        err.flush(STDERR_FILENO);
+    }
+    return ok ? 0 : 1;
+}
+
+// Answers every --aggregate spec from one scan of the inputs.
+static int runAggregates(const Options& opt) {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    QueryPlan plan;
+    std::vector<AggregateSpec> specs(opt.aggregates.size());
+    for (size_t i = 0; i < specs.size(); ++i) {
+        parseAggregateSpec(opt.aggregates[i], specs[i]);
+        if (plan.add(specs[i]) < 0) {
+            std::cerr << "app: invalid aggregate " << opt.aggregates[i] << "\n";
+            return 2;
+        }
+    }
+    plan.ingestFiles(opt.inputs);
+
+    OutputBuffer out;
+    for (size_t i = 0; i < specs.size(); ++i)
+        formatAggregate(out, opt.aggregates[i], specs[i].keys.size(), plan.result((int)i), opt.format);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::high_resolution_clock::now() - t0).count();
+    if (opt.format == OutputFormat::Text) {
+        out.put("EXEC_MS\n");
+        out.putInt(ms);
+        out.put('\n');
+    }
+    bool ok = out.flush(STDOUT_FILENO);
+    if (opt.stats) {
+        OutputBuffer err(256);
+        err.put("rows=");
+        err.putInt(plan.rowsRead());
+        err.put("\naccepted=");
+        err.putInt(plan.rowsAccepted());
+        err.put('\n');
+        err.flush(STDERR_FILENO);
+    }
+    return ok ? 0 : 1;
+}
+
+// SIGINT/SIGTERM during a checkpointed ingest: stop at the next checkpoint.
+static TripAnalyzer* stoppable = nullptr;
+
+static void stopAtCheckpoint(int) {
+    if (stoppable) stoppable->stopIngest();
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    int rc = parseArgs(argc, argv, opt);
+    if (rc >= 0) return rc;
+    if (opt.windowMinutes > 0) return runWindow(opt);
+    if (!opt.aggregates.empty()) return runAggregates(opt);
+
     auto t0 = std::chrono::high_resolution_clock::now();
 
     TripAnalyzer analyzer;
-    analyzer.ingestFile("SmallTrips.csv");
+    analyzer.setMode(opt.mode);
+    analyzer.setReadMode(opt.reader);
+    analyzer.setAsyncReads(opt.ioDepth, AsyncFileReader::kDefaultBlock, opt.ioBackend);
+    analyzer.setThreads(opt.threads);
+    analyzer.setDedup(opt.dedup);
+    analyzer.setStrictTimestamps(opt.strictTime);
+    analyzer.setHugePages(opt.hugePages);
+    analyzer.setProfiling(opt.profile);
+    if (opt.memoryBudgetMb > 0) analyzer.setMemoryBudget(size_t(opt.memoryBudgetMb) << 20, opt.spillDir);
+    if (!opt.zoneCatalog.empty() && !analyzer.loadZoneCatalog(opt.zoneCatalog, opt.unknownZones)) {
+        std::cerr << "app: cannot read zone catalog " << opt.zoneCatalog << "\n";
+        return 1;
+    }
+    if (!opt.quarantine.empty() && !analyzer.setQuarantine(opt.quarantine, opt.quarantineEvery, opt.quarantineMax)) {
+        std::cerr << "app: cannot create quarantine file " << opt.quarantine << "\n";
+        return 1;
+    }
+    if (!opt.checkpoint.empty()) analyzer.setCheckpoint(opt.checkpoint, (long long)std::max(opt.checkpointEveryMb, 1) << 20);
+    if (analyzer.checkpointing()) {
+        stoppable = &analyzer;
+        std::signal(SIGINT, stopAtCheckpoint);
+        std::signal(SIGTERM, stopAtCheckpoint);
+    }
+    analyzer.ingestFiles(opt.inputs);
+    if (analyzer.stats().stopped) {
+        std::cerr << "app: stopped; run again with --checkpoint " << opt.checkpoint << " to resume\n";
+        return 130;
+    }
+    if (analyzer.stats().spillFailed) {
+        std::cerr << "app: cannot write a spill run under " << (opt.spillDir.empty() ? "$TMPDIR or /tmp" : opt.spillDir)
+                  << "; ingest stopped at the memory budget\n";
+        return 1;
+    }
+
+    auto tIngest = std::chrono::high_resolution_clock::now();
 
-    printZones(analyzer.topZones(10));
-    printSlots(analyzer.topBusySlots(10));
+    OutputBuffer out;
+    formatZones(out, analyzer.topZones(opt.zonesK), opt.format);
+    formatSlots(out, analyzer.topBusySlots(opt.slotsK), opt.format);
+    if (analyzer.spillReadFailed()) {
+        std::cerr << "app: a spill run went missing or was damaged; no results\n";
+        return 1;
+    }
 
     auto t1 = std::chrono::high_resolution_clock::now();
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
 
-    std::cout << "EXEC_MS\n" << ms << "\n";
-    return 0;
+    if (opt.format == OutputFormat::Text) {
+        out.put("EXEC_MS\n");
+        out.putInt(ms);
+        out.put('\n');
+    }
+    bool ok = out.flush(STDOUT_FILENO);
+
+    if (!opt.snapshotOut.empty() && !analyzer.saveSnapshot(opt.snapshotOut)) {
+        std::cerr << "app: cannot write snapshot " << opt.snapshotOut << "\n";
+        ok = false;
+    }
+
+    if (opt.stats) {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+        const IngestStats& st = analyzer.stats();
+        OutputBuffer err(4096);
+        auto line = [&err](const char* name, long long v) {
+            err.put(name);
+            err.put('=');
+            err.putInt(v);
+            err.put('\n');
+        };
+        line("files", st.filesRead);
+        line("bytes", st.bytesRead);
+        line("rows", st.rowsRead);
+        line("accepted", st.rowsAccepted);
+        line("malformed", st.rowsMalformed);
+        line("duplicates", st.duplicatesRejected);
+        line("unknown_zones", st.unknownZones);
+        line("spill_runs", st.spillRuns);
+        line("quarantined", st.rowsQuarantined);
+        if (!opt.checkpoint.empty()) {
+            line("checkpoints", st.checkpointsWritten);
+            line("resumed_bytes", st.resumedBytes);
+        }
+        line("ingest_us", duration_cast<microseconds>(tIngest - t0).count());
+        line("query_us", duration_cast<microseconds>(t1 - tIngest).count());
+        if (opt.profile) {
+            const PhaseProfile& pp = analyzer.profile();
+            const std::pair<const char*, const PerfSample*> phases[] = {
+                {"ingest", &pp.ingest}, {"select", &pp.select}, {"sort", &pp.sort}};
+            for (const auto& ph : phases) {
+                for (int c = 0; c < PerfSample::kCount; ++c) {
+                    err.put(ph.first);
+                    err.put('.');
+                    err.put(PerfSample::name(c));
+                    err.put('=');
+                    if (ph.second->has((PerfSample::Counter)c)) err.putInt((long long)ph.second->value[c]);
+                    else err.put("n/a");
+                    err.put('\n');
+                }
+            }
+        }
+        err.flush(STDERR_FILENO);
+    }
+    return ok ? 0 : 1;
 }
@@ -0,0 +1,211 @@
+#include "output.h"
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <unistd.h>
+using namespace std;
+
+bool parseOutputFormat(const string& name, OutputFormat& fmt) {
+    if (name == "text") fmt = OutputFormat::Text;
+    else if (name == "csv") fmt = OutputFormat::Csv;
+    else if (name == "jsonl" || name == "json") fmt = OutputFormat::JsonLines;
+    else if (name == "binary" || name == "bin") fmt = OutputFormat::Binary;
+    else return false;
+    return true;
+}
+
+void OutputBuffer::putInt(long long v) {
+    char tmp[24];
+    auto res = to_chars(tmp, tmp + sizeof(tmp), v);
+    buf.append(tmp, res.ptr - tmp);
+}
+
+void OutputBuffer::putJsonString(std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    buf.push_back('"');
+    for (char ch : s) {
+        unsigned char c = (unsigned char)ch;
+        if (c == '"' || c == '\\') {
+            buf.push_back('\\');
+            buf.push_back(ch);
+        } else if (c < 0x20) {
+            buf.append("\\u00");
+            buf.push_back(hex[c >> 4]);
+            buf.push_back(hex[c & 15]);
+        } else {
+            buf.push_back(ch);
+        }
+    }
+    buf.push_back('"');
+}
+
+void OutputBuffer::putCsvField(std::string_view s) {
+    if (s.find_first_of(",\"\r\n") == std::string_view::npos) {
+        put(s);
+        return;
+    }
+    buf.push_back('"');
+    for (char c : s) {
+        if (c == '"') buf.push_back('"');
+        buf.push_back(c);
+    }
+    buf.push_back('"');
+}
+
+// Wide enough for any finite double in fixed notation.
+void OutputBuffer::putFixed(double v, int decimals) {
+    char tmp[400];
+    auto res = to_chars(tmp, tmp + sizeof(tmp), v, chars_format::fixed, decimals);
+    if (res.ec == errc()) buf.append(tmp, res.ptr - tmp);
+    else buf.append("nan");
+}
+
+bool OutputBuffer::flush(int fd) {
+    const char* p = buf.data();
+    size_t left = buf.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    buf.clear();
+    return true;
+}
+
+static const uint32_t kZoneTag = 0x454e4f5a;   // "ZONE"
+static const uint32_t kSlotTag = 0x544f4c53;   // "SLOT"
+static const uint32_t kAggregateTag = 0x52474741;   // "AGGR"
+
+void formatZones(OutputBuffer& out, const vector<ZoneCount>& v, OutputFormat fmt) {
+    switch (fmt) {
+    case OutputFormat::Text:
+    case OutputFormat::Csv:
+        out.put(fmt == OutputFormat::Text ? "TOP_ZONES\n" : "zone,count\n");
+        for (const auto& x : v) {
+            if (fmt == OutputFormat::Csv) out.putCsvField(x.zone);
+            else out.put(x.zone);
+            out.put(',');
+            out.putInt(x.count);
+            out.put('\n');
+        }
+        break;
+    case OutputFormat::JsonLines:
+        for (const auto& x : v) {
+            out.put("{\"type\":\"zone\",\"zone\":");
+            out.putJsonString(x.zone);
+            out.put(",\"count\":");
+            out.putInt(x.count);
+            out.put("}\n");
+        }
+        break;
+    case OutputFormat::Binary:
+        out.putRaw(kZoneTag);
+        out.putRaw((uint64_t)v.size());
+        for (const auto& x : v) {
+            out.putRaw((uint32_t)x.zone.size());
+            out.put(x.zone);
+            out.putRaw((int64_t)x.count);
+        }
+        break;
+    }
+}
+
+void formatSlots(OutputBuffer& out, const vector<SlotCount>& v, OutputFormat fmt) {
+    switch (fmt) {
+    case OutputFormat::Text:
+    case OutputFormat::Csv:
+        out.put(fmt == OutputFormat::Text ? "TOP_SLOTS\n" : "zone,hour,count\n");
+        for (const auto& x : v) {
+            if (fmt == OutputFormat::Csv) out.putCsvField(x.zone);
+            else out.put(x.zone);
+            out.put(',');
+            out.putInt(x.hour);
+            out.put(',');
+            out.putInt(x.count);
+            out.put('\n');
+        }
+        break;
+    case OutputFormat::JsonLines:
+        for (const auto& x : v) {
+            out.put("{\"type\":\"slot\",\"zone\":");
+            out.putJsonString(x.zone);
+            out.put(",\"hour\":");
+            out.putInt(x.hour);
+            out.put(",\"count\":");
+            out.putInt(x.count);
+            out.put("}\n");
+        }
+        break;
+    case OutputFormat::Binary:
+        out.putRaw(kSlotTag);
+        out.putRaw((uint64_t)v.size());
+        for (const auto& x : v) {
+            out.putRaw((uint32_t)x.zone.size());
+            out.put(x.zone);
+            out.putRaw((int32_t)x.hour);
+            out.putRaw((int64_t)x.count);
+        }
+        break;
+    }
+}
+
+// Whole values inside the long long range print as integers; NaN,
+// infinities and anything larger go through putFixed.
+static void putValue(OutputBuffer& out, double v) {
+    if (isfinite(v) && v >= -0x1p63 && v < 0x1p63 && v == (double)(long long)v) out.putInt((long long)v);
+    else out.putFixed(v, 2);
+}
+
+void formatAggregate(OutputBuffer& out, const string& title, size_t nKeys,
+                     const vector<AggregateRow>& rows, OutputFormat fmt) {
+    switch (fmt) {
+    case OutputFormat::Text:
+    case OutputFormat::Csv:
+        out.put(fmt == OutputFormat::Text ? "AGG " : "# ");
+        out.put(title);
+        out.put('\n');
+        for (const auto& r : rows) {
+            for (const auto& k : r.key) {
+                if (fmt == OutputFormat::Csv) out.putCsvField(k);
+                else out.put(k);
+                out.put(',');
+            }
+            putValue(out, r.value);
+            out.put('\n');
+        }
+        break;
+    case OutputFormat::JsonLines:
+        for (const auto& r : rows) {
+            out.put("{\"type\":\"aggregate\",\"spec\":");
+            out.putJsonString(title);
+            out.put(",\"key\":[");
+            for (size_t i = 0; i < r.key.size(); ++i) {
+                if (i) out.put(',');
+                out.putJsonString(r.key[i]);
+            }
+            out.put("],\"value\":");
+            putValue(out, r.value);
+            out.put("}\n");
+        }
+        break;
+    case OutputFormat::Binary:
+        out.putRaw(kAggregateTag);
+        out.putRaw((uint32_t)title.size());
+        out.put(title);
+        out.putRaw((uint32_t)nKeys);
+        out.putRaw((uint64_t)rows.size());
+        for (const auto& r : rows) {
+            for (const auto& k : r.key) {
+                out.putRaw((uint32_t)k.size());
+                out.put(k);
+            }
+            out.putRaw(r.value);
+        }
+        break;
+    }
+}
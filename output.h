@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include "analyzer.h"
+#include "queryplan.h"
+using namespace std;
+
+// Text is the historical TOP_ZONES/TOP_SLOTS listing printed by app.
+enum class OutputFormat { Text, Csv, JsonLines, Binary };
+
+bool parseOutputFormat(const string& name, OutputFormat& fmt);
+
+// Append-only byte buffer: numbers are formatted with std::to_chars and
+// the whole result goes out in one write() instead of per-field ostream
+// insertions.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(size_t reserveBytes = 1 << 20) { buf.reserve(reserveBytes); }
+    void put(std::string_view s) { buf.append(s.data(), s.size()); }
+    void put(char c) { buf.push_back(c); }
+    void putInt(long long v);
+    void putFixed(double v, int decimals);
+    void putJsonString(std::string_view s);
+    // s as one CSV field, quoted per RFC 4180 if it holds , " CR or LF.
+    void putCsvField(std::string_view s);
+    template <class T> void putRaw(const T& v) { buf.append((const char*)&v, sizeof(T)); }
+    size_t size() const { return buf.size(); }
+    std::string_view view() const { return buf; }
+    // Writes everything to fd (retrying short writes) and empties the buffer.
+    bool flush(int fd);
+private:
+    std::string buf;
+};
+
+// Csv quotes zone names and keys that need it; Text prints them as is.
+// Binary layout (native endian), one section per call:
+//   u32 tag ('ZONE' or 'SLOT') | u64 n | { u32 len, bytes, [i32 hour], i64 count }*
+void formatZones(OutputBuffer& out, const vector<ZoneCount>& v, OutputFormat fmt);
+void formatSlots(OutputBuffer& out, const vector<SlotCount>& v, OutputFormat fmt);
+
+// One QueryPlan aggregate, titled by its spec text. Whole values print as
+// integers, others with two decimals. Binary:
+//   u32 'AGGR' | u32 len, title | u32 nKeys | u64 n | { { u32 len, bytes }* f64 value }*
+void formatAggregate(OutputBuffer& out, const string& title, size_t nKeys,
+                     const vector<AggregateRow>& rows, OutputFormat fmt);
@@ -0,0 +1,71 @@
+#include "perfcounters.h"
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+using namespace std;
+
+const char* PerfSample::name(int c) {
+    static const char* names[kCount] = {"cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses"};
+    return c >= 0 && c < kCount ? names[c] : "?";
+}
+
+static int openCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void PerfCounters::openAll() {
+    opened = true;
+    fd[PerfSample::Cycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fd[PerfSample::Instructions] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fd[PerfSample::LlcMisses] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fd[PerfSample::BranchMisses] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fd[PerfSample::DtlbMisses] = openCounter(PERF_TYPE_HW_CACHE,
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+PerfCounters::~PerfCounters() {
+    for (int f : fd)
+        if (f >= 0) close(f);
+}
+
+bool PerfCounters::available() {
+    if (!opened) openAll();
+    for (int f : fd)
+        if (f >= 0) return true;
+    return false;
+}
+
+void PerfCounters::start() {
+    if (!opened) openAll();
+    for (int f : fd) {
+        if (f < 0) continue;
+        ioctl(f, PERF_EVENT_IOC_RESET, 0);
+        ioctl(f, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+PerfSample PerfCounters::stop() {
+    PerfSample s;
+    for (int c = 0; c < PerfSample::kCount; ++c) {
+        if (fd[c] < 0) continue;
+        ioctl(fd[c], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t buf[3];   // value, time enabled, time running
+        if (read(fd[c], buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[2] == 0) continue;
+        // Scale up if the PMU multiplexed this counter.
+        s.value[c] = buf[2] < buf[1] ? (uint64_t)((double)buf[0] * buf[1] / buf[2]) : buf[0];
+        s.valid |= 1u << c;
+    }
+    return s;
+}
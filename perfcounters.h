@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+using namespace std;
+
+// Hardware counter readings for one measured phase. A counter the kernel
+// or CPU refuses to provide stays 0 and has its bit cleared in `valid`.
+struct PerfSample {
+    enum Counter { Cycles, Instructions, LlcMisses, BranchMisses, DtlbMisses, kCount };
+    uint64_t value[kCount] = {};
+    unsigned valid = 0;
+
+    uint64_t cycles() const { return value[Cycles]; }
+    uint64_t instructions() const { return value[Instructions]; }
+    uint64_t llcMisses() const { return value[LlcMisses]; }
+    uint64_t branchMisses() const { return value[BranchMisses]; }
+    uint64_t dtlbMisses() const { return value[DtlbMisses]; }
+    bool has(Counter c) const { return valid & (1u << c); }
+    static const char* name(int c);
+};
+
+// perf_event_open counters for the calling thread (and threads it starts
+// while counting), user space only. Opened lazily on the first start();
+// copies never share file descriptors.
+class PerfCounters {
+public:
+    PerfCounters() = default;
+    PerfCounters(const PerfCounters&) {}
+    PerfCounters& operator=(const PerfCounters&) { return *this; }
+    ~PerfCounters();
+
+    bool available();            // at least one counter could be opened
+    void start();
+    PerfSample stop();
+
+private:
+    void openAll();
+    int fd[PerfSample::kCount] = {-1, -1, -1, -1, -1};
+    bool opened = false;
+};
@@ -0,0 +1,215 @@
+#include "quantiles.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+using namespace std;
+
+void QuantileSketches::setHugePages(HugePagePolicy policy) {
+    handles = HugeVector<uint32_t>(HugePageAllocator<uint32_t>(policy));
+    small.setHugePages(policy);
+    medium.setHugePages(policy);
+    digests.setHugePages(policy);
+}
+
+void QuantileSketches::clear() {
+    handles.clear();
+    small.clear();
+    medium.clear();
+    digests.clear();
+}
+
+size_t QuantileSketches::bytes() const {
+    return handles.capacity() * sizeof(uint32_t) + small.bytes() + medium.bytes() + digests.bytes();
+}
+
+void QuantileSketches::add(uint32_t id, float value) {
+    if (std::isnan(value)) return;
+    if (id >= handles.size()) handles.resize(size_t(id) + 1, 0);
+    uint32_t& h = handles[id];
+    if (h == 0) h = kSmall | small.alloc();
+    switch (h & ~kSlot) {
+    case kSmall: {
+        Small& s = small[h & kSlot];
+        if (s.n < 7) {
+            s.v[s.n++] = value;
+            return;
+        }
+        uint32_t m = medium.alloc();
+        Medium& md = medium[m];
+        copy(s.v, s.v + s.n, md.v);
+        md.n = s.n;
+        md.v[md.n++] = value;
+        small.release(h & kSlot);
+        h = kMedium | m;
+        return;
+    }
+    case kMedium: {
+        Medium& md = medium[h & kSlot];
+        if (md.n < 31) {
+            md.v[md.n++] = value;
+            return;
+        }
+        break;
+    }
+    }
+    Digest& d = toDigest(h);
+    if (d.buffered == Digest::kBuffer) compress(d, nullptr, 0);
+    d.buffer[d.buffered++] = value;
+}
+
+// Upgrades a raw sketch in place: its values become the digest's buffer.
+QuantileSketches::Digest& QuantileSketches::toDigest(uint32_t& handle) {
+    if ((handle & ~kSlot) == kDigest) return digests[handle & kSlot];
+    uint32_t slot = digests.alloc();
+    Digest& d = digests[slot];
+    if ((handle & ~kSlot) == kMedium) {
+        Medium& md = medium[handle & kSlot];
+        copy(md.v, md.v + md.n, d.buffer);
+        d.buffered = md.n;
+        medium.release(handle & kSlot);
+    } else if ((handle & ~kSlot) == kSmall) {
+        Small& s = small[handle & kSlot];
+        copy(s.v, s.v + s.n, d.buffer);
+        d.buffered = s.n;
+        small.release(handle & kSlot);
+    }
+    handle = kDigest | slot;
+    return d;
+}
+
+// Merges the centroids, the buffered values and extra into at most
+// kCentroids centroids. A centroid may grow until it spans one unit of
+// k(q) = delta / (2 pi) * asin(2q - 1), which keeps centroids small (and
+// quantiles precise) near both tails.
+void QuantileSketches::compress(Digest& d, const Centroid* extra, size_t n) const {
+    scratch.assign(d.c, d.c + d.centroids);
+    for (uint32_t i = 0; i < d.buffered; ++i) scratch.push_back({d.buffer[i], 1});
+    scratch.insert(scratch.end(), extra, extra + n);
+    if (scratch.empty()) return;
+    sort(scratch.begin(), scratch.end(), [](const Centroid& a, const Centroid& b) { return a.mean < b.mean; });
+
+    double total = 0;
+    for (const Centroid& c : scratch) total += c.weight;
+    const double step = 2 * M_PI / kCompression;
+    auto limitAfter = [&](double soFar) {
+        double k = asin(2 * soFar / total - 1) + step;
+        return k >= M_PI / 2 ? total : total * (sin(k) + 1) / 2;
+    };
+
+    bool empty = d.weight == 0;
+    d.min = empty ? scratch.front().mean : min(d.min, scratch.front().mean);
+    d.max = empty ? scratch.back().mean : max(d.max, scratch.back().mean);
+    uint32_t out = 0;
+    double mean = scratch[0].mean, weight = scratch[0].weight, soFar = 0;
+    double limit = limitAfter(0);
+    for (size_t i = 1; i < scratch.size(); ++i) {
+        const Centroid& c = scratch[i];
+        if (soFar + weight + c.weight <= limit || out + 1 == (uint32_t)Digest::kCentroids) {
+            weight += c.weight;
+            mean += (c.mean - mean) * c.weight / weight;
+        } else {
+            d.c[out++] = {(float)mean, (float)weight};
+            soFar += weight;
+            limit = limitAfter(soFar);
+            mean = c.mean;
+            weight = c.weight;
+        }
+    }
+    d.c[out++] = {(float)mean, (float)weight};
+    d.centroids = out;
+    d.buffered = 0;
+    d.weight = total;
+}
+
+// Centroid i stands for the weight around its cumulative midpoint; ranks
+// between midpoints interpolate linearly, and the outer half-centroids
+// interpolate towards the exact min and max.
+double QuantileSketches::digestQuantile(const Digest& d, double q) {
+    if (d.centroids == 0) return numeric_limits<double>::quiet_NaN();
+    if (q <= 0) return d.min;
+    if (q >= 1) return d.max;
+    double target = q * d.weight;
+    const Centroid* c = d.c;
+    double center = c[0].weight / 2;
+    if (target < center) return d.min + (c[0].mean - d.min) * target / center;
+    double cum = 0;
+    for (uint32_t i = 0; i + 1 < d.centroids; ++i) {
+        double next = cum + c[i].weight + c[i + 1].weight / 2;
+        if (target < next) return c[i].mean + (c[i + 1].mean - c[i].mean) * (target - center) / (next - center);
+        cum += c[i].weight;
+        center = next;
+    }
+    double rest = d.weight - center;
+    const Centroid& last = c[d.centroids - 1];
+    return rest > 0 ? last.mean + (d.max - last.mean) * (target - center) / rest : last.mean;
+}
+
+// Raw sketches answer exactly (linear interpolation between order
+// statistics); digests flush their buffer into a copy first.
+double QuantileSketches::quantile(uint32_t id, double q) const {
+    uint32_t h = id < handles.size() ? handles[id] : 0;
+    if (h == 0) return numeric_limits<double>::quiet_NaN();
+    q = min(max(q, 0.0), 1.0);
+    if ((h & ~kSlot) == kDigest) {
+        const Digest& d = digests[h & kSlot];
+        if (d.buffered == 0) return digestQuantile(d, q);
+        Digest flushed = d;
+        compress(flushed, nullptr, 0);
+        return digestQuantile(flushed, q);
+    }
+    float v[31];
+    uint32_t n;
+    if ((h & ~kSlot) == kSmall) {
+        const Small& s = small[h & kSlot];
+        n = s.n;
+        copy(s.v, s.v + n, v);
+    } else {
+        const Medium& md = medium[h & kSlot];
+        n = md.n;
+        copy(md.v, md.v + n, v);
+    }
+    sort(v, v + n);
+    double pos = q * (n - 1);
+    uint32_t lo = (uint32_t)pos;
+    if (lo + 1 >= n) return v[n - 1];
+    return v[lo] + (v[lo + 1] - v[lo]) * (pos - lo);
+}
+
+uint64_t QuantileSketches::count(uint32_t id) const {
+    uint32_t h = id < handles.size() ? handles[id] : 0;
+    switch (h & ~kSlot) {
+    case kSmall: return small[h & kSlot].n;
+    case kMedium: return medium[h & kSlot].n;
+    case kDigest: return (uint64_t)digests[h & kSlot].weight + digests[h & kSlot].buffered;
+    }
+    return 0;
+}
+
+void QuantileSketches::merge(uint32_t id, const QuantileSketches& other, uint32_t otherId) {
+    uint32_t oh = otherId < other.handles.size() ? other.handles[otherId] : 0;
+    switch (oh & ~kSlot) {
+    case kSmall: {
+        const Small& s = other.small[oh & kSlot];
+        for (uint32_t i = 0; i < s.n; ++i) add(id, s.v[i]);
+        return;
+    }
+    case kMedium: {
+        const Medium& md = other.medium[oh & kSlot];
+        for (uint32_t i = 0; i < md.n; ++i) add(id, md.v[i]);
+        return;
+    }
+    case kDigest: break;
+    default: return;
+    }
+    const Digest& od = other.digests[oh & kSlot];
+    vector<Centroid> extra(od.c, od.c + od.centroids);
+    for (uint32_t i = 0; i < od.buffered; ++i) extra.push_back({od.buffer[i], 1});
+    if (id >= handles.size()) handles.resize(size_t(id) + 1, 0);
+    Digest& d = toDigest(handles[id]);
+    compress(d, extra.data(), extra.size());
+    // Centroid means lie inside other's range; its exact extremes do not.
+    if (od.weight > 0) {
+        d.min = min(d.min, od.min);
+        d.max = max(d.max, od.max);
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "hugepage.h"
+using namespace std;
+
+// Fixed-size records handed out by index from one growing array, with a
+// free list; millions of small sketches cost a handful of allocations.
+template <class T>
+class SlabPool {
+public:
+    void setHugePages(HugePagePolicy policy) {
+        items = HugeVector<T>(HugePageAllocator<T>(policy));
+        freeSlots.clear();
+    }
+    uint32_t alloc() {
+        if (!freeSlots.empty()) {
+            uint32_t i = freeSlots.back();
+            freeSlots.pop_back();
+            items[i] = T();
+            return i;
+        }
+        items.emplace_back();
+        return (uint32_t)(items.size() - 1);
+    }
+    void release(uint32_t i) { freeSlots.push_back(i); }
+    T& operator[](uint32_t i) { return items[i]; }
+    const T& operator[](uint32_t i) const { return items[i]; }
+    void clear() {
+        items.clear();
+        freeSlots.clear();
+    }
+    size_t bytes() const { return items.capacity() * sizeof(T) + freeSlots.capacity() * 4; }
+private:
+    HugeVector<T> items;
+    vector<uint32_t> freeSlots;
+};
+
+// A family of mergeable quantile sketches addressed by dense ids (the
+// analyzer uses zone * 25 + hour, hour 24 being the whole zone). A sketch
+// keeps its raw values while it has few of them, so small groups are
+// exact, and becomes a merging t-digest (k1 scale, kCompression) once it
+// outgrows the raw classes: rank error is about 1% around the median
+// and smaller towards the tails. Each size class is a SlabPool.
+class QuantileSketches {
+public:
+    static const int kCompression = 64;
+
+    void setHugePages(HugePagePolicy policy);
+    void add(uint32_t id, float value);
+    // Value at rank q in [0, 1]; NaN if the sketch is empty.
+    double quantile(uint32_t id, double q) const;
+    uint64_t count(uint32_t id) const;
+    // Folds other's sketch otherId into sketch id.
+    void merge(uint32_t id, const QuantileSketches& other, uint32_t otherId);
+    void clear();
+    size_t bytes() const;
+
+private:
+    struct Centroid {
+        float mean, weight;
+    };
+    template <int N>
+    struct Raw {
+        uint32_t n = 0;
+        float v[N];
+    };
+    using Small = Raw<7>;       // 32 bytes
+    using Medium = Raw<31>;     // 128 bytes
+    struct Digest {
+        static const int kCentroids = kCompression + 1;
+        static const int kBuffer = 32;
+        uint32_t centroids = 0, buffered = 0;
+        float min = 0, max = 0;
+        double weight = 0;      // centroid weights, buffer excluded
+        Centroid c[kCentroids];
+        float buffer[kBuffer];
+    };
+    // handle: size class in the top two bits, pool slot below; 0 = empty.
+    enum : uint32_t { kSmall = 1u << 30, kMedium = 2u << 30, kDigest = 3u << 30, kSlot = (1u << 30) - 1 };
+
+    Digest& toDigest(uint32_t& handle);
+    void compress(Digest& d, const Centroid* extra, size_t n) const;
+    static double digestQuantile(const Digest& d, double q);
+
+    HugeVector<uint32_t> handles;
+    SlabPool<Small> small;
+    SlabPool<Medium> medium;
+    SlabPool<Digest> digests;
+    mutable vector<Centroid> scratch;
+};
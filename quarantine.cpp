@@ -0,0 +1,80 @@
+#include "quarantine.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+using namespace std;
+
+const char* rejectReasonName(RejectReason r) {
+    switch (r) {
+    case RejectReason::Columns: return "columns";
+    case RejectReason::EmptyZone: return "empty_zone";
+    case RejectReason::BadTime: return "bad_time";
+    case RejectReason::UnknownZone: return "unknown_zone";
+    case RejectReason::Duplicate: return "duplicate";
+    }
+    return "?";
+}
+
+shared_ptr<QuarantineSink> QuarantineSink::open(const string& path, long long sampleEvery, long long maxRows) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return nullptr;
+    return shared_ptr<QuarantineSink>(new QuarantineSink(fd, sampleEvery, maxRows));
+}
+
+QuarantineSink::QuarantineSink(int fd, long long sampleEvery, long long maxRows)
+    : fd(fd), every(sampleEvery < 1 ? 1 : sampleEvery), cap(maxRows) {
+    buf.reserve(kBuffer);
+    buf = "reason,file,offset,row\n";
+}
+
+QuarantineSink::~QuarantineSink() {
+    flush();
+    close(fd);
+}
+
+static void putField(string& out, string_view s) {
+    out.push_back('"');
+    for (char c : s) {
+        if (c == '"') out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+bool QuarantineSink::record(RejectReason reason, string_view file, long long offset, string_view row) {
+    lock_guard<mutex> guard(lock);
+    if (seen++ % every != 0 || (cap >= 0 && rows >= cap)) return false;
+    ++rows;
+    buf.append(rejectReasonName(reason));
+    buf.push_back(',');
+    putField(buf, file);
+    buf.push_back(',');
+    buf.append(to_string(offset));
+    buf.push_back(',');
+    if (!row.empty() && row.back() == '\r') row.remove_suffix(1);
+    putField(buf, row);
+    buf.push_back('\n');
+    if (buf.size() >= kBuffer) flushLocked();
+    return true;
+}
+
+bool QuarantineSink::flush() {
+    lock_guard<mutex> guard(lock);
+    return flushLocked();
+}
+
+bool QuarantineSink::flushLocked() {
+    const char* p = buf.data();
+    size_t left = buf.size();
+    while (left > 0 && !failed) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) failed = true;
+        else {
+            p += n;
+            left -= (size_t)n;
+        }
+    }
+    buf.clear();
+    return !failed;
+}
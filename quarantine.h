@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+using namespace std;
+
+// Why ingest turned a data row away.
+enum class RejectReason : uint8_t { Columns, EmptyZone, BadTime, UnknownZone, Duplicate };
+const char* rejectReasonName(RejectReason r);
+
+// Side file of rejected rows, one CSV line each:
+//   reason,file,offset,"raw row"
+// offset is the row's first byte in its file. Only every sampleEvery-th
+// rejection is written, at most maxRows of them (negative = no cap), so
+// a badly broken feed cannot flood the disk. Lines collect in a buffer
+// flushed with one write(2) per kBuffer bytes. Thread-safe: one sink
+// serves all ingest workers, which only reach it on the reject path.
+class QuarantineSink {
+public:
+    static const size_t kBuffer = 64 << 10;
+
+    // Null if path cannot be created.
+    static shared_ptr<QuarantineSink> open(const string& path, long long sampleEvery = 1,
+                                           long long maxRows = -1);
+    ~QuarantineSink();
+    QuarantineSink(const QuarantineSink&) = delete;
+    QuarantineSink& operator=(const QuarantineSink&) = delete;
+
+    // True if the row was written (sampled in and under the cap).
+    bool record(RejectReason reason, string_view file, long long offset, string_view row);
+    bool flush();
+    long long rejected() const { return seen; }
+    long long written() const { return rows; }
+
+private:
+    QuarantineSink(int fd, long long sampleEvery, long long maxRows);
+    bool flushLocked();
+    mutex lock;
+    int fd;
+    long long every, cap;
+    long long seen = 0, rows = 0;
+    string buf;
+    bool failed = false;
+};
@@ -0,0 +1,217 @@
+#include "queryplan.h"
+#include "civiltime.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+using namespace std;
+
+static const char* const kDimensionNames[] = {"pickup", "dropoff", "hour", "weekday", "date"};
+static const char* const kMeasureNames[] = {"count", "fare", "distance"};
+static const int kDimensionBits[] = {PickupZone::kBits, DropoffZone::kBits, Hour::kBits,
+                                     Weekday::kBits, Date::kBits};
+
+bool parseAggregateSpec(const string& text, AggregateSpec& spec) {
+    AggregateSpec out;
+    size_t c1 = text.find(':');
+    if (c1 == string::npos) return false;
+    size_t c2 = text.find(':', c1 + 1);
+    string dims = text.substr(0, c1);
+    string measure = text.substr(c1 + 1, c2 == string::npos ? string::npos : c2 - c1 - 1);
+
+    for (size_t pos = 0; pos <= dims.size();) {
+        size_t comma = dims.find(',', pos);
+        if (comma == string::npos) comma = dims.size();
+        string name = dims.substr(pos, comma - pos);
+        auto it = find(begin(kDimensionNames), end(kDimensionNames), name);
+        if (it == end(kDimensionNames)) return false;
+        out.keys.push_back(Dimension(it - begin(kDimensionNames)));
+        pos = comma + 1;
+    }
+    auto m = find(begin(kMeasureNames), end(kMeasureNames), measure);
+    if (m == end(kMeasureNames)) return false;
+    out.measure = Measure(m - begin(kMeasureNames));
+    if (c2 != string::npos) {
+        string k = text.substr(c2 + 1);
+        if (k.empty() || k.find_first_not_of("0123456789") != string::npos || k.size() > 9) return false;
+        out.k = stoi(k);
+    }
+    spec = out;
+    return true;
+}
+
+// Runtime-layout key: every aggregate packs into 128 bits, first dimension
+// highest, so GroupBy only needs the hash.
+struct PlanKey {
+    using Packed = unsigned __int128;
+    static uint64_t hash(Packed k) { return hashPacked(k); }
+};
+
+static bool dimensionValid(Dimension d, const TripRow& r) {
+    return d == Dimension::Weekday ? Weekday::valid(r) : d == Dimension::Date ? Date::valid(r) : true;
+}
+
+static uint64_t dimensionValue(Dimension d, const TripRow& r) {
+    switch (d) {
+    case Dimension::PickupZone: return PickupZone::get(r);
+    case Dimension::DropoffZone: return DropoffZone::get(r);
+    case Dimension::Hour: return Hour::get(r);
+    case Dimension::Weekday: return Weekday::get(r);
+    case Dimension::Date: return Date::get(r);
+    }
+    return 0;
+}
+
+static string renderField(Dimension d, uint64_t v, const ZoneTable& names) {
+    static const char* const kWeekdays[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+    switch (d) {
+    case Dimension::PickupZone:
+    case Dimension::DropoffZone: return string(names.name((uint32_t)v));
+    case Dimension::Weekday: return kWeekdays[v % 7];
+    case Dimension::Date: {
+        int y, m, dd;
+        civilFromDays((long long)v, y, m, dd);
+        char buf[40];
+        snprintf(buf, sizeof(buf), "%04d-%02d-%02d", y, m, dd);
+        return buf;
+    }
+    default: return to_string(v);
+    }
+}
+
+struct QueryPlan::Aggregate {
+    struct Field {
+        Dimension dim;
+        int offset, bits;
+    };
+    AggregateSpec spec;
+    vector<Field> layout;
+
+    explicit Aggregate(const AggregateSpec& s) : spec(s) {
+        int offset = 0;
+        for (size_t i = spec.keys.size(); i-- > 0;) {
+            int bits = kDimensionBits[(int)spec.keys[i]];
+            layout.insert(layout.begin(), Field{spec.keys[i], offset, bits});
+            offset += bits;
+        }
+    }
+    virtual ~Aggregate() = default;
+    virtual void add(const TripRow& r) = 0;
+    virtual vector<AggregateRow> top(const ZoneTable& names) const = 0;
+
+    bool pack(const TripRow& r, PlanKey::Packed& k) const {
+        k = 0;
+        for (const Field& f : layout) {
+            if (!dimensionValid(f.dim, r)) return false;
+            k |= PlanKey::Packed(dimensionValue(f.dim, r)) << f.offset;
+        }
+        return true;
+    }
+    uint64_t field(PlanKey::Packed k, const Field& f) const {
+        return uint64_t(k >> f.offset) & ((uint64_t(1) << f.bits) - 1);
+    }
+    bool keyBefore(PlanKey::Packed a, PlanKey::Packed b, const ZoneTable& names) const {
+        for (const Field& f : layout) {
+            uint64_t x = field(a, f), y = field(b, f);
+            if (x == y) continue;
+            if (f.dim == Dimension::PickupZone || f.dim == Dimension::DropoffZone)
+                return names.name((uint32_t)x) < names.name((uint32_t)y);
+            return x < y;
+        }
+        return false;
+    }
+};
+
+namespace {
+
+// The measure is fixed per aggregate at add() time, so the table and its
+// per-row update are the compile-time GroupBy for that measure.
+template <class M>
+struct MeasureAggregate : QueryPlan::Aggregate {
+    using Aggregate::Aggregate;
+    GroupBy<PlanKey, M> groups;
+
+    void add(const TripRow& r) override {
+        PlanKey::Packed k;
+        if (pack(r, k)) groups.addKey(k, r);
+    }
+
+    vector<AggregateRow> top(const ZoneTable& names) const override {
+        using Entry = pair<PlanKey::Packed, typename M::Value>;
+        vector<Entry> all;
+        all.reserve(groups.size());
+        groups.forEach([&all](PlanKey::Packed k, const typename GroupBy<PlanKey, M>::Values& v) {
+            all.push_back({k, get<0>(v)});
+        });
+        auto before = [&](const Entry& a, const Entry& b) {
+            if (a.second != b.second) return a.second > b.second;
+            return keyBefore(a.first, b.first, names);
+        };
+        size_t kk = min(all.size(), (size_t)max(spec.k, 0));
+        nth_element(all.begin(), all.begin() + kk, all.end(), before);
+        sort(all.begin(), all.begin() + kk, before);
+
+        vector<AggregateRow> rows(kk);
+        for (size_t i = 0; i < kk; ++i) {
+            for (const Field& f : layout) rows[i].key.push_back(renderField(f.dim, field(all[i].first, f), names));
+            rows[i].value = (double)all[i].second;
+        }
+        return rows;
+    }
+};
+
+}  // namespace
+
+QueryPlan::QueryPlan() {
+    decoder.setFields(0);
+}
+
+QueryPlan::~QueryPlan() = default;
+
+int QueryPlan::add(const AggregateSpec& spec) {
+    if (spec.keys.empty() || read > 0) return -1;
+    unsigned fields = 0;
+    for (size_t i = 0; i < spec.keys.size(); ++i) {
+        if (count(spec.keys.begin(), spec.keys.begin() + i, spec.keys[i])) return -1;
+        if (spec.keys[i] == Dimension::DropoffZone) fields |= TripRowDecoder::kDropoff;
+        if (spec.keys[i] == Dimension::Weekday || spec.keys[i] == Dimension::Date) fields |= TripRowDecoder::kDate;
+    }
+    switch (spec.measure) {
+    case Measure::Count: aggregates.push_back(make_unique<MeasureAggregate<Count>>(spec)); break;
+    case Measure::SumFare:
+        aggregates.push_back(make_unique<MeasureAggregate<SumFare>>(spec));
+        fields |= TripRowDecoder::kFare;
+        break;
+    case Measure::SumDistance:
+        aggregates.push_back(make_unique<MeasureAggregate<SumDistance>>(spec));
+        fields |= TripRowDecoder::kDistance;
+        break;
+    }
+    neededFields |= fields;
+    decoder.setFields(neededFields);
+    return (int)aggregates.size() - 1;
+}
+
+bool QueryPlan::ingestFile(const string& csvPath) {
+    ifstream file(csvPath);
+    if (!file) return false;
+    string line;
+    getline(file, line);
+    decoder.setHeader(line);
+    TripRow row;
+    while (getline(file, line)) {
+        ++read;
+        if (!decoder.decode(line.data(), line.data() + line.size(), row)) continue;
+        ++accepted;
+        for (auto& a : aggregates) a->add(row);
+    }
+    return true;
+}
+
+void QueryPlan::ingestFiles(const vector<string>& csvPaths) {
+    for (const auto& path : csvPaths) ingestFile(path);
+}
+
+vector<AggregateRow> QueryPlan::result(int id) const {
+    if (id < 0 || id >= (int)aggregates.size()) return {};
+    return aggregates[id]->top(decoder.zones());
+}
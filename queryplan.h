@@ -0,0 +1,54 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "groupby.h"
+using namespace std;
+
+enum class Dimension { PickupZone, DropoffZone, Hour, Weekday, Date };
+enum class Measure { Count, SumFare, SumDistance };
+
+// One aggregate of a plan: group by keys (in order), rank by measure.
+struct AggregateSpec {
+    vector<Dimension> keys;
+    Measure measure = Measure::Count;
+    int k = 10;
+};
+
+// "pickup,hour:count:10" -> spec. Dimensions: pickup, dropoff, hour,
+// weekday, date; measures: count, fare, distance; k defaults to 10.
+bool parseAggregateSpec(const string& text, AggregateSpec& spec);
+
+struct AggregateRow {
+    vector<string> key;       // one rendered field per dimension
+    double value;
+};
+
+// Several aggregates over one scan: every row is split and decoded once
+// (only the fields some aggregate needs), and the decoded row, with its
+// zones already resolved to dictionary indices, is handed to each
+// aggregate in turn. Results rank like topZones/topBusySlots: value
+// desc, then key fields in order (zones by name).
+class QueryPlan {
+public:
+    QueryPlan();
+    ~QueryPlan();
+    // Returns the aggregate's id, or -1 if the spec is empty, repeats a
+    // dimension, or ingest has already started.
+    int add(const AggregateSpec& spec);
+    size_t size() const { return aggregates.size(); }
+
+    bool ingestFile(const string& csvPath);
+    void ingestFiles(const vector<string>& csvPaths);
+    vector<AggregateRow> result(int id) const;
+    long long rowsRead() const { return read; }
+    long long rowsAccepted() const { return accepted; }
+
+    struct Aggregate;
+
+private:
+    TripRowDecoder decoder;
+    unsigned neededFields = 0;
+    vector<unique_ptr<Aggregate>> aggregates;
+    long long read = 0, accepted = 0;
+};
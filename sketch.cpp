@@ -0,0 +1,271 @@
+#include "sketch.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+using namespace std;
+
+// ---------------- Count-Min ----------------
+
+CountMinSketch::CountMinSketch(size_t width, size_t depth) : w(1), d(depth ? depth : 1) {
+    while (w < width) w <<= 1;
+    table.assign(w * d, 0);
+}
+
+void CountMinSketch::add(uint64_t keyHash, uint64_t n) {
+    uint64_t h1 = keyHash, h2 = (keyHash >> 32) | 1;
+    for (size_t r = 0; r < d; ++r)
+        table[r * w + ((h1 + r * h2) & (w - 1))] += n;
+}
+
+uint64_t CountMinSketch::estimate(uint64_t keyHash) const {
+    uint64_t h1 = keyHash, h2 = (keyHash >> 32) | 1;
+    uint64_t best = UINT64_MAX;
+    for (size_t r = 0; r < d; ++r)
+        best = min(best, table[r * w + ((h1 + r * h2) & (w - 1))]);
+    return best;
+}
+
+bool CountMinSketch::merge(const CountMinSketch& other) {
+    if (other.w != w || other.d != d) return false;
+    for (size_t i = 0; i < table.size(); ++i) table[i] += other.table[i];
+    return true;
+}
+
+void CountMinSketch::clear() {
+    fill(table.begin(), table.end(), 0);
+}
+
+// ---------------- HyperLogLog ----------------
+
+HyperLogLog::HyperLogLog(int precision) : p(min(max(precision, 4), 18)) {
+    regs.assign(size_t(1) << p, 0);
+}
+
+void HyperLogLog::add(uint64_t hash) {
+    size_t idx = hash >> (64 - p);
+    uint64_t rest = (hash << p) | (uint64_t(1) << (p - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > regs[idx]) regs[idx] = rank;
+}
+
+double HyperLogLog::estimate() const {
+    double m = (double)regs.size();
+    double sum = 0;
+    size_t zeros = 0;
+    for (uint8_t r : regs) {
+        sum += std::ldexp(1.0, -r);
+        if (r == 0) ++zeros;
+    }
+    double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double est = alpha * m * m / sum;
+    if (est <= 2.5 * m && zeros > 0)
+        est = m * std::log(m / (double)zeros);   // linear counting
+    return est;
+}
+
+bool HyperLogLog::merge(const HyperLogLog& other) {
+    if (other.p != p) return false;
+    for (size_t i = 0; i < regs.size(); ++i) regs[i] = max(regs[i], other.regs[i]);
+    return true;
+}
+
+void HyperLogLog::clear() {
+    fill(regs.begin(), regs.end(), 0);
+}
+
+// ---------------- heavy hitters ----------------
+
+void HeavyHitters::place(size_t i) {
+    pos[heap[i].hash] = i;
+}
+
+void HeavyHitters::siftUp(size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap[parent].count <= heap[i].count) break;
+        swap(heap[parent], heap[i]);
+        place(i);
+        i = parent;
+    }
+    place(i);
+}
+
+void HeavyHitters::siftDown(size_t i) {
+    size_t n = heap.size();
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && heap[l].count < heap[m].count) m = l;
+        if (r < n && heap[r].count < heap[m].count) m = r;
+        if (m == i) break;
+        swap(heap[m], heap[i]);
+        place(i);
+        i = m;
+    }
+    place(i);
+}
+
+void HeavyHitters::offer(std::string_view zone, int hour, uint64_t hash, uint64_t estimate) {
+    if (cap == 0) return;
+    auto it = pos.find(hash);
+    if (it != pos.end()) {
+        Entry& e = heap[it->second];
+        if (e.hour == hour && e.zone == zone) {
+            if (estimate > e.count) {
+                e.count = estimate;
+                siftDown(it->second);
+            }
+            return;
+        }
+        return;   // 64-bit hash collision with a different key: keep incumbent
+    }
+    if (heap.size() < cap) {
+        heap.push_back({std::string(zone), hour, hash, estimate});
+        siftUp(heap.size() - 1);
+        return;
+    }
+    if (estimate <= heap[0].count) return;
+    pos.erase(heap[0].hash);
+    heap[0] = {std::string(zone), hour, hash, estimate};
+    siftDown(0);
+}
+
+void HeavyHitters::clear() {
+    heap.clear();
+    pos.clear();
+}
+
+// ---------------- trip sketch ----------------
+
+TripSketch::TripSketch(size_t cmsWidth, size_t cmsDepth, int hllPrecision, size_t candidates)
+    : cms(cmsWidth, cmsDepth), zonesHll(hllPrecision), tripsHll(hllPrecision),
+      topZoneHits(candidates), topSlotHits(candidates) {}
+
+void TripSketch::add(std::string_view zone, int hour, std::string_view tripId) {
+    uint64_t zh = hashBytes(zone.data(), zone.size());
+    uint64_t th = mixHour(zh, kZoneTotal);
+    uint64_t sh = mixHour(zh, hour);
+    cms.add(th);
+    cms.add(sh);
+    zonesHll.add(zh);
+    tripsHll.add(hashBytes(tripId.data(), tripId.size(), 0x7452495049ULL));
+    ++total;
+    topZoneHits.offer(zone, -1, th, cms.estimate(th));
+    topSlotHits.offer(zone, hour, sh, cms.estimate(sh));
+}
+
+uint64_t TripSketch::estimateZone(std::string_view zone) const {
+    return cms.estimate(mixHour(hashBytes(zone.data(), zone.size()), kZoneTotal));
+}
+
+uint64_t TripSketch::estimateSlot(std::string_view zone, int hour) const {
+    return cms.estimate(mixHour(hashBytes(zone.data(), zone.size()), hour));
+}
+
+size_t TripSketch::memoryBytes() const {
+    return cms.cells().size() * sizeof(uint64_t)
+         + zonesHll.registers().size() + tripsHll.registers().size()
+         + (topZoneHits.capacity() + topSlotHits.capacity()) * (sizeof(HeavyHitters::Entry) + 32);
+}
+
+bool TripSketch::merge(const TripSketch& other) {
+    if (other.cms.width() != cms.width() || other.cms.depth() != cms.depth() ||
+        other.zonesHll.precision() != zonesHll.precision())
+        return false;
+    cms.merge(other.cms);
+    zonesHll.merge(other.zonesHll);
+    tripsHll.merge(other.tripsHll);
+    total += other.total;
+
+    // Candidates are re-scored against the merged counters: a key that was
+    // second-tier in both shards can be a heavy hitter of the union.
+    auto rescore = [this](HeavyHitters& hh, const HeavyHitters& a, const HeavyHitters& b) {
+        vector<HeavyHitters::Entry> all(a.entries());
+        all.insert(all.end(), b.entries().begin(), b.entries().end());
+        hh.clear();
+        for (const auto& e : all) hh.offer(e.zone, e.hour, e.hash, cms.estimate(e.hash));
+    };
+    HeavyHitters zonesCopy = topZoneHits, slotsCopy = topSlotHits;
+    rescore(topZoneHits, zonesCopy, other.topZoneHits);
+    rescore(topSlotHits, slotsCopy, other.topSlotHits);
+    return true;
+}
+
+void TripSketch::clear() {
+    cms.clear();
+    zonesHll.clear();
+    tripsHll.clear();
+    topZoneHits.clear();
+    topSlotHits.clear();
+    total = 0;
+}
+
+// On-disk layout (native endian):
+//   "TSK1" | u64 width | u64 depth | u32 hllP | u64 candidates | u64 total
+//   | cms cells | zone HLL | trip HLL | u64 nCand | { i32 hour, u32 len, bytes }*
+static const char kSketchMagic[4] = {'T', 'S', 'K', '1'};
+
+template <class T>
+static void putRaw(ofstream& out, const T& v) { out.write((const char*)&v, sizeof(T)); }
+
+template <class T>
+static bool getRaw(ifstream& in, T& v) { return (bool)in.read((char*)&v, sizeof(T)); }
+
+bool TripSketch::save(const string& path) const {
+    ofstream out(path, ios::binary);
+    if (!out) return false;
+    out.write(kSketchMagic, 4);
+    putRaw(out, (uint64_t)cms.width());
+    putRaw(out, (uint64_t)cms.depth());
+    putRaw(out, (uint32_t)zonesHll.precision());
+    putRaw(out, (uint64_t)topZoneHits.capacity());
+    putRaw(out, total);
+    out.write((const char*)cms.cells().data(), cms.cells().size() * sizeof(uint64_t));
+    out.write((const char*)zonesHll.registers().data(), zonesHll.registers().size());
+    out.write((const char*)tripsHll.registers().data(), tripsHll.registers().size());
+    putRaw(out, (uint64_t)(topZoneHits.entries().size() + topSlotHits.entries().size()));
+    for (const HeavyHitters* hh : {&topZoneHits, &topSlotHits}) {
+        for (const auto& e : hh->entries()) {
+            putRaw(out, (int32_t)e.hour);
+            putRaw(out, (uint32_t)e.zone.size());
+            out.write(e.zone.data(), e.zone.size());
+        }
+    }
+    return (bool)out;
+}
+
+bool TripSketch::load(const string& path) {
+    ifstream in(path, ios::binary);
+    char magic[4];
+    if (!in.read(magic, 4) || !equal(magic, magic + 4, kSketchMagic)) return false;
+    uint64_t width, depth, candidates, savedTotal;
+    uint32_t precision;
+    if (!getRaw(in, width) || !getRaw(in, depth) || !getRaw(in, precision) ||
+        !getRaw(in, candidates) || !getRaw(in, savedTotal))
+        return false;
+    if (width == 0 || (width & (width - 1)) || depth == 0 || depth > 64 ||
+        width > (1u << 26) || precision < 4 || precision > 18 || candidates > (1u << 24))
+        return false;
+
+    TripSketch loaded(width, depth, precision, candidates);
+    loaded.total = savedTotal;
+    in.read((char*)loaded.cms.cells().data(), loaded.cms.cells().size() * sizeof(uint64_t));
+    in.read((char*)loaded.zonesHll.registers().data(), loaded.zonesHll.registers().size());
+    in.read((char*)loaded.tripsHll.registers().data(), loaded.tripsHll.registers().size());
+    uint64_t nCand;
+    if (!in || !getRaw(in, nCand)) return false;
+    string zone;
+    for (uint64_t i = 0; i < nCand; ++i) {
+        int32_t hour;
+        uint32_t len;
+        if (!getRaw(in, hour) || !getRaw(in, len) || len > (1u << 20)) return false;
+        zone.resize(len);
+        if (!in.read(&zone[0], len)) return false;
+        if (hour < -1 || hour > 23) return false;
+        uint64_t zh = hashBytes(zone.data(), zone.size());
+        uint64_t h = mixHour(zh, hour < 0 ? kZoneTotal : hour);
+        HeavyHitters& hh = hour < 0 ? loaded.topZoneHits : loaded.topSlotHits;
+        hh.offer(zone, hour, h, loaded.cms.estimate(h));
+    }
+    *this = std::move(loaded);
+    return true;
+}
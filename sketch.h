@@ -0,0 +1,119 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+using namespace std;
+
+// 64-bit hash for short keys (zone IDs, trip IDs). FNV-1a followed by a
+// splitmix64 finalizer so the high and low halves are both usable.
+inline uint64_t hashBytes(const char* p, size_t n, uint64_t seed = 0) {
+    uint64_t h = 1469598103934665603ULL ^ seed;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+inline uint64_t mixHour(uint64_t zoneHash, int hour) {
+    uint64_t h = zoneHash + 0x9e3779b97f4a7c15ULL * (uint64_t)(hour + 1);
+    h ^= h >> 29; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// Count-Min sketch: depth rows of width counters, width a power of two.
+class CountMinSketch {
+public:
+    CountMinSketch(size_t width = 1u << 16, size_t depth = 4);
+    void add(uint64_t keyHash, uint64_t n = 1);
+    uint64_t estimate(uint64_t keyHash) const;
+    bool merge(const CountMinSketch& other);
+    void clear();
+    size_t width() const { return w; }
+    size_t depth() const { return d; }
+    const vector<uint64_t>& cells() const { return table; }
+    vector<uint64_t>& cells() { return table; }
+private:
+    size_t w, d;
+    vector<uint64_t> table;
+};
+
+// HyperLogLog with 2^p one-byte registers (p = 14 -> 16 KB, ~0.8% error).
+class HyperLogLog {
+public:
+    explicit HyperLogLog(int p = 14);
+    void add(uint64_t hash);
+    double estimate() const;
+    bool merge(const HyperLogLog& other);
+    void clear();
+    int precision() const { return p; }
+    const vector<uint8_t>& registers() const { return regs; }
+    vector<uint8_t>& registers() { return regs; }
+private:
+    int p;
+    vector<uint8_t> regs;
+};
+
+// Bounded set of heavy-hitter candidates kept as an indexed min-heap on
+// the current estimate, so the weakest candidate is evicted in O(log cap).
+class HeavyHitters {
+public:
+    struct Entry {
+        std::string zone;
+        int hour;             // -1 for zone totals
+        uint64_t hash;
+        uint64_t count;
+    };
+    explicit HeavyHitters(size_t capacity = 1024) : cap(capacity) {}
+    void offer(std::string_view zone, int hour, uint64_t hash, uint64_t estimate);
+    const vector<Entry>& entries() const { return heap; }
+    size_t capacity() const { return cap; }
+    void clear();
+private:
+    void siftUp(size_t i);
+    void siftDown(size_t i);
+    void place(size_t i);
+    size_t cap;
+    vector<Entry> heap;
+    unordered_map<uint64_t, size_t> pos;
+};
+
+// Fixed-memory summary of a trip stream: (zone,hour) and zone frequencies
+// in a Count-Min sketch, distinct zones / trip IDs in HyperLogLogs, and
+// heavy-hitter candidates for top-k. Sketches of the same shape merge
+// exactly (CMS cells add, HLL registers max), so shards and days combine.
+class TripSketch {
+public:
+    static const int kZoneTotal = 24;   // hour slot used for zone totals
+
+    TripSketch(size_t cmsWidth = 1u << 16, size_t cmsDepth = 4,
+               int hllPrecision = 14, size_t candidates = 1024);
+    void add(std::string_view zone, int hour, std::string_view tripId);
+    uint64_t estimateZone(std::string_view zone) const;
+    uint64_t estimateSlot(std::string_view zone, int hour) const;
+    double distinctZones() const { return zonesHll.estimate(); }
+    double distinctTrips() const { return tripsHll.estimate(); }
+    uint64_t totalTrips() const { return total; }
+    const HeavyHitters& zoneCandidates() const { return topZoneHits; }
+    const HeavyHitters& slotCandidates() const { return topSlotHits; }
+    size_t memoryBytes() const;
+
+    bool merge(const TripSketch& other);
+    void clear();
+    bool save(const string& path) const;
+    bool load(const string& path);
+private:
+    CountMinSketch cms;
+    HyperLogLog zonesHll;
+    HyperLogLog tripsHll;
+    HeavyHitters topZoneHits;
+    HeavyHitters topSlotHits;
+    uint64_t total = 0;
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include "hugepage.h"
+using namespace std;
+
+// Per-(zone, hour) trip counts in narrow lanes. A lane that reaches its
+// maximum becomes a marker and the exact count moves to a side table, so
+// reads stay exact while the common case costs 2 (or 4) bytes per cell
+// instead of 8. Row z holds cells [z*24, z*24+24).
+template <class Lane>
+class CompactSlotMatrix {
+public:
+    static const Lane kSpilled = numeric_limits<Lane>::max();
+
+    void setHugePages(HugePagePolicy policy) {
+        cells = HugeVector<Lane>(HugePageAllocator<Lane>(policy));
+        wide.clear();
+    }
+    void clear() {
+        cells.clear();
+        wide.clear();
+    }
+    size_t zones() const { return cells.size() / 24; }
+    void addZone() { cells.resize(cells.size() + 24, 0); }
+    void reserve(size_t zones) { cells.reserve(zones * 24); }
+
+    void increment(uint32_t zone, int hour) {
+        size_t i = size_t(zone) * 24 + hour;
+        if (__builtin_expect(cells[i] < kSpilled - 1, 1)) ++cells[i];
+        else promote(i);
+    }
+    void prefetch(uint32_t zone, int hour) const {
+        __builtin_prefetch(&cells[size_t(zone) * 24 + hour], 1);
+    }
+    long long get(uint32_t zone, int hour) const {
+        size_t i = size_t(zone) * 24 + hour;
+        return cells[i] == kSpilled ? wide.at(i) : cells[i];
+    }
+    void add(uint32_t zone, int hour, long long n) {
+        size_t i = size_t(zone) * 24 + hour;
+        set(i, (cells[i] == kSpilled ? wide.at(i) : cells[i]) + n);
+    }
+    // True if every hour of the zone is zero (cheap pre-check for scans).
+    bool rowEmpty(uint32_t zone) const {
+        const Lane* r = &cells[size_t(zone) * 24];
+        Lane acc = 0;
+        for (int h = 0; h < 24; ++h) acc |= r[h];
+        return acc == 0;
+    }
+    array<long long, 24> row(uint32_t zone) const {
+        array<long long, 24> out;
+        for (int h = 0; h < 24; ++h) out[h] = get(zone, h);
+        return out;
+    }
+    size_t spilledCells() const { return wide.size(); }
+    size_t bytes() const { return cells.capacity() * sizeof(Lane) + wide.size() * 32; }
+
+private:
+    __attribute__((noinline, cold)) void promote(size_t i) {
+        if (cells[i] == kSpilled) ++wide[i];
+        else set(i, (long long)cells[i] + 1);
+    }
+    void set(size_t i, long long v) {
+        if (v < (long long)kSpilled) {
+            if (cells[i] == kSpilled) wide.erase(i);
+            cells[i] = (Lane)v;
+        } else {
+            cells[i] = kSpilled;
+            wide[i] = v;
+        }
+    }
+
+    HugeVector<Lane> cells;
+    unordered_map<size_t, long long> wide;
+};
+
+// 16-bit lanes: most cells stay under 65535 trips.
+using SlotMatrix = CompactSlotMatrix<uint16_t>;
@@ -0,0 +1,39 @@
+// snapmerge: combine per-shard snapshot files into one and optionally
+// print the global top-k without touching the original CSVs.
+//
+//   snapmerge [-k N] OUT.snap IN1.snap IN2.snap ...
+#include "analyzer.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    int k = 0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-k") == 0 && i + 1 < argc) k = std::atoi(argv[++i]);
+        else args.push_back(argv[i]);
+    }
+    if (args.size() < 2) {
+        std::cerr << "usage: snapmerge [-k N] OUT.snap IN.snap...\n";
+        return 2;
+    }
+    std::vector<std::string> inputs(args.begin() + 1, args.end());
+    if (!mergeSnapshotFiles(inputs, args[0])) {
+        std::cerr << "snapmerge: failed to merge into " << args[0] << "\n";
+        return 1;
+    }
+    if (k <= 0) return 0;
+
+    TripAnalyzer analyzer;
+    if (!analyzer.loadSnapshot(args[0])) {
+        std::cerr << "snapmerge: cannot read " << args[0] << "\n";
+        return 1;
+    }
+    std::cout << "TOP_ZONES\n";
+    for (const auto& z : analyzer.topZones(k)) std::cout << z.zone << "," << z.count << "\n";
+    std::cout << "TOP_SLOTS\n";
+    for (const auto& s : analyzer.topBusySlots(k))
+        std::cout << s.zone << "," << s.hour << "," << s.count << "\n";
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "snapshot.h"
+#include <algorithm>
+#include <queue>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+using namespace std;
+
+static const char kSnapshotMagic[4] = {'T', 'S', 'N', '1'};
+
+template <class T>
+static void putRaw(ofstream& out, const T& v) { out.write((const char*)&v, sizeof(T)); }
+
+template <class T>
+static bool getRaw(ifstream& in, T& v) { return (bool)in.read((char*)&v, sizeof(T)); }
+
+bool SnapshotWriter::open(const string& path) {
+    out.open(path, ios::binary | ios::trunc);
+    if (!out) return false;
+    count = 0;
+    out.write(kSnapshotMagic, 4);
+    putRaw(out, count);          // patched in close()
+    return (bool)out;
+}
+
+void SnapshotWriter::write(const ZoneRecord& rec) {
+    putRaw(out, (uint32_t)rec.zone.size());
+    out.write(rec.zone.data(), rec.zone.size());
+    putRaw(out, (int64_t)rec.total);
+    uint32_t mask = 0;
+    for (int h = 0; h < 24; ++h)
+        if (rec.hours[h] != 0) mask |= 1u << h;
+    putRaw(out, mask);
+    for (int h = 0; h < 24; ++h)
+        if (mask & (1u << h)) putRaw(out, (int64_t)rec.hours[h]);
+    ++count;
+}
+
+bool SnapshotWriter::close() {
+    if (!out.is_open()) return false;
+    out.seekp(4);
+    putRaw(out, count);
+    bool ok = (bool)out;
+    out.close();
+    return ok;
+}
+
+bool SnapshotReader::open(const string& path) {
+    in.open(path, ios::binary);
+    char magic[4];
+    bad = !in.read(magic, 4) || !equal(magic, magic + 4, kSnapshotMagic) || !getRaw(in, declared);
+    consumed = 0;
+    return !bad;
+}
+
+bool SnapshotReader::next(ZoneRecord& rec) {
+    if (bad || consumed == declared) return false;
+    uint32_t len, mask;
+    int64_t total;
+    if (!getRaw(in, len) || len > (1u << 20)) { bad = true; return false; }
+    rec.zone.resize(len);
+    if (!in.read(&rec.zone[0], len) || !getRaw(in, total) || !getRaw(in, mask)) {
+        bad = true;
+        return false;
+    }
+    rec.total = total;
+    rec.hours.fill(0);
+    for (int h = 0; h < 24; ++h) {
+        if (!(mask & (1u << h))) continue;
+        int64_t c;
+        if (!getRaw(in, c)) { bad = true; return false; }
+        rec.hours[h] = c;
+    }
+    ++consumed;
+    return true;
+}
+
+void mergeZoneStreams(vector<RecordSource>& sources, const function<void(const ZoneRecord&)>& sink) {
+    vector<ZoneRecord> heads(sources.size());
+    // min-heap of source indices ordered by their current head zone
+    auto cmp = [&heads](size_t a, size_t b) { return heads[a].zone > heads[b].zone; };
+    priority_queue<size_t, vector<size_t>, decltype(cmp)> pq(cmp);
+    for (size_t i = 0; i < sources.size(); ++i)
+        if (sources[i](heads[i])) pq.push(i);
+
+    ZoneRecord acc;
+    bool have = false;
+    while (!pq.empty()) {
+        size_t i = pq.top();
+        pq.pop();
+        if (have && heads[i].zone == acc.zone) {
+            acc.total += heads[i].total;
+            for (int h = 0; h < 24; ++h) acc.hours[h] += heads[i].hours[h];
+        } else {
+            if (have) sink(acc);
+            acc = heads[i];
+            have = true;
+        }
+        if (sources[i](heads[i])) pq.push(i);
+    }
+    if (have) sink(acc);
+}
+
+bool mergeSnapshotFiles(const vector<string>& inputs, const string& output) {
+    vector<SnapshotReader> readers(inputs.size());
+    vector<RecordSource> sources;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (!readers[i].open(inputs[i])) return false;
+        SnapshotReader& r = readers[i];
+        sources.push_back([&r](ZoneRecord& rec) { return r.next(rec); });
+    }
+
+    // Written beside output and renamed over it only when complete, so a
+    // failed merge leaves no partial file and output may be an input.
+    string tmp = output + ".tmp";
+    SnapshotWriter writer;
+    bool ok = writer.open(tmp);
+    if (ok) mergeZoneStreams(sources, [&writer](const ZoneRecord& rec) { writer.write(rec); });
+    for (const auto& r : readers)
+        if (r.failed()) ok = false;
+    ok = writer.close() && ok;
+    if (!ok || rename(tmp.c_str(), output.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+shared_ptr<ScratchSnapshot> ScratchSnapshot::create(const string& dir) {
+    string pattern = (dir.empty() ? string(".") : dir) + "/trip-spill-XXXXXX";
+    int fd = mkstemp(&pattern[0]);
+    if (fd < 0) return nullptr;
+    close(fd);
+    return shared_ptr<ScratchSnapshot>(new ScratchSnapshot(pattern));
+}
+
+ScratchSnapshot::~ScratchSnapshot() {
+    unlink(file.c_str());
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Exact per-zone state as stored in snapshot files.
+struct ZoneRecord {
+    std::string zone;
+    long long total = 0;
+    array<long long, 24> hours{};
+};
+
+// Snapshot layout (native endian), records sorted by zone so any number of
+// snapshots can be combined with a streaming k-way merge:
+//   "TSN1" | u64 zoneCount | { u32 len, bytes, i64 total, u32 hourMask,
+//                              i64 count per set bit of hourMask }*
+class SnapshotWriter {
+public:
+    bool open(const string& path);
+    // Records must arrive in strictly increasing zone order.
+    void write(const ZoneRecord& rec);
+    bool close();
+    uint64_t written() const { return count; }
+private:
+    ofstream out;
+    uint64_t count = 0;
+};
+
+class SnapshotReader {
+public:
+    bool open(const string& path);
+    bool next(ZoneRecord& rec);
+    uint64_t zoneCount() const { return declared; }
+    bool failed() const { return bad; }
+private:
+    ifstream in;
+    uint64_t declared = 0, consumed = 0;
+    bool bad = false;
+};
+
+// Pulls the next record of a zone-sorted stream; false at the end.
+using RecordSource = function<bool(ZoneRecord&)>;
+
+// k-way merge of zone-sorted streams: records of one zone are summed and
+// handed to sink once, in zone order. Memory is one record per source.
+void mergeZoneStreams(vector<RecordSource>& sources, const function<void(const ZoneRecord&)>& sink);
+
+// Snapshot file in a scratch directory, deleted when the last owner drops it.
+class ScratchSnapshot {
+public:
+    // Null if no file can be created in dir.
+    static shared_ptr<ScratchSnapshot> create(const string& dir);
+    ~ScratchSnapshot();
+    ScratchSnapshot(const ScratchSnapshot&) = delete;
+    ScratchSnapshot& operator=(const ScratchSnapshot&) = delete;
+    const string& path() const { return file; }
+private:
+    explicit ScratchSnapshot(string path) : file(std::move(path)) {}
+    string file;
+};
+
+// k-way merge of zone-sorted snapshots into one snapshot. Memory is one
+// record per input; time is O(total records * log inputs).
+bool mergeSnapshotFiles(const vector<string>& inputs, const string& output);
@@ -1,10 +1,47 @@
 #include "analyzer.h"
+#include "kernels.h"
+#include "zonecatalog.h"
+#include "window.h"
+#include "groupby.h"
+#include "queryplan.h"
+#include "quantiles.h"
+#include "civiltime.h"
+#include "asyncreader.h"
+#include "output.h"
 #include "catch_amalgamated.hpp"
 
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <map>
 #include <string>
 #include <vector>
 #include <cstdio>   // std::remove
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <filesystem>
+
+// ------------------- allocation counter -------------------
+// Test-build hook: every global operator new bumps a counter so ingest
+// paths can be checked for per-row allocations.
+static std::atomic<long long> g_allocations{0};
+
+void* operator new(std::size_t n) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](std::size_t n) { return operator new(n); }
+// GCC cannot see that new above is malloc and flags the frees once
+// allocations get inlined into them.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
 
 // ------------------- helpers -------------------
 static void writeFile(const std::string& path, const std::vector<std::string>& lines) {
@@ -281,3 +318,1567 @@ TEST_CASE("C3", "[C3]") {
 
     std::remove(path.c_str());
 }
+
+// ------------------- D: extensions -------------------
+
+TEST_CASE("D1 sketch mode", "[D1]") {
+    const std::string pathA = "d1a.csv", pathB = "d1b.csv";
+
+    // Two shards: a skewed head (ZONE_HOT, ZONE_WARM) over a long tail.
+    auto writeShard = [](const std::string& path, long long firstId, int tail) {
+        std::ofstream out(path);
+        REQUIRE(out.is_open());
+        out << HDR << "\n";
+        long long id = firstId;
+        for (int i = 0; i < 5000; ++i, ++id) out << id << ",ZONE_HOT,ZX,2024-01-01 07:10,1,1\n";
+        for (int i = 0; i < 2000; ++i, ++id) out << id << ",ZONE_WARM,ZX,2024-01-01 19:10,1,1\n";
+        for (int i = 0; i < tail; ++i, ++id) out << id << ",TAIL_" << i << ",ZX,2024-01-01 03:00,1,1\n";
+    };
+    writeShard(pathA, 1, 20000);
+    writeShard(pathB, 100000, 20000);
+
+    TripAnalyzer a, b;
+    a.setMode(IngestMode::Sketch);
+    b.setMode(IngestMode::Sketch);
+    a.ingestFile(pathA);
+    b.ingestFile(pathB);
+
+    auto topZ = a.topZones(2);
+    REQUIRE(topZ.size() == 2);
+    REQUIRE(topZ[0].zone == "ZONE_HOT");
+    REQUIRE(topZ[0].count >= 5000);
+    REQUIRE(topZ[0].count <= 5100);
+    REQUIRE(topZ[1].zone == "ZONE_WARM");
+
+    // Shards share TAIL_* names, so distinct zones stay ~20k after merging
+    // while distinct trip IDs double.
+    REQUIRE(a.sketch().merge(b.sketch()));
+    REQUIRE(a.approxDistinctZones() == Catch::Approx(20002).epsilon(0.05));
+    REQUIRE(a.approxDistinctTrips() == Catch::Approx(54000).epsilon(0.05));
+
+    auto topS = a.topBusySlots(1);
+    REQUIRE(topS.size() == 1);
+    REQUIRE(topS[0].zone == "ZONE_HOT");
+    REQUIRE(topS[0].hour == 7);
+    REQUIRE(topS[0].count >= 10000);
+
+    REQUIRE(a.sketch().save("d1.sketch"));
+    TripSketch reloaded;
+    REQUIRE(reloaded.load("d1.sketch"));
+    REQUIRE(reloaded.estimateZone("ZONE_WARM") == a.sketch().estimateZone("ZONE_WARM"));
+    REQUIRE(reloaded.totalTrips() == 54000);
+    REQUIRE(a.sketch().memoryBytes() < (8u << 20));
+
+    std::remove(pathA.c_str());
+    std::remove(pathB.c_str());
+    std::remove("d1.sketch");
+}
+
+TEST_CASE("D2 TripID dedup", "[D2]") {
+    const std::string path = "d2.csv";
+
+    std::vector<std::string> batch = {
+        "10,ZONE_A,ZX,2024-01-01 09:15,1,1",
+        "11,ZONE_A,ZX,2024-01-01 10:15,1,1",
+        "12,ZONE_B,ZX,2024-01-01 10:15,1,1",
+        "T-9001,ZONE_C,ZX,2024-01-01 11:00,1,1",
+        "99999999999,ZONE_C,ZX,2024-01-01 11:00,1,1",
+    };
+    std::vector<std::string> lines = {HDR};
+    lines.insert(lines.end(), batch.begin(), batch.end());
+    lines.push_back("13,,ZX,2024-01-01 10:15,1,1");           // malformed
+    lines.insert(lines.end(), batch.begin(), batch.end());    // replayed batch
+    lines.push_back("T-9002,ZONE_C,ZX,2024-01-01 11:00,1,1");
+    writeFile(path, lines);
+
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(hasZone(plain.topZones(10), "ZONE_A", 4));
+    REQUIRE(plain.stats().duplicatesRejected == 0);
+
+    TripAnalyzer ta;
+    ta.setDedup(true);
+    ta.ingestFile(path);
+
+    auto topZ = ta.topZones(10);
+    REQUIRE(hasZone(topZ, "ZONE_A", 2));
+    REQUIRE(hasZone(topZ, "ZONE_B", 1));
+    REQUIRE(hasZone(topZ, "ZONE_C", 3));
+    REQUIRE(hasSlot(ta.topBusySlots(10), "ZONE_A", 10, 1));
+
+    const IngestStats& st = ta.stats();
+    REQUIRE(st.rowsRead == 12);
+    REQUIRE(st.rowsAccepted == 6);
+    REQUIRE(st.duplicatesRejected == 5);
+    REQUIRE(st.rowsMalformed == 1);
+
+    // Exact mode starts every ingest with an empty seen-set.
+    ta.ingestFile(path);
+    REQUIRE(hasZone(ta.topZones(10), "ZONE_A", 2));
+
+    // Leading zeros make a different ID, not the same number.
+    writeFile(path, {HDR,
+                     "7,ZONE_D,ZX,2024-01-01 09:00,1,1",
+                     "007,ZONE_D,ZX,2024-01-01 09:00,1,1",
+                     "07,ZONE_D,ZX,2024-01-01 09:00,1,1",
+                     "007,ZONE_D,ZX,2024-01-01 09:00,1,1"});
+    TripAnalyzer lead;
+    lead.setDedup(true);
+    lead.ingestFile(path);
+    REQUIRE(hasZone(lead.topZones(10), "ZONE_D", 3));
+    REQUIRE(lead.stats().rowsAccepted == 3);
+    REQUIRE(lead.stats().duplicatesRejected == 1);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D3 shard merge and snapshots", "[D3]") {
+    const std::vector<std::string> shardA = {
+        "1,ZONE_A,ZX,2024-01-01 09:00,1,1",
+        "2,ZONE_B,ZX,2024-01-01 09:00,1,1",
+        "3,ZONE_A,ZX,2024-01-01 10:00,1,1",
+    };
+    const std::vector<std::string> shardB = {
+        "4,ZONE_C,ZX,2024-01-01 09:00,1,1",
+        "5,ZONE_B,ZX,2024-01-01 09:00,1,1",
+        "6,ZONE_B,ZX,2024-01-01 23:00,1,1",
+        "7,zone_a,ZX,2024-01-01 10:00,1,1",
+    };
+    std::vector<std::string> a = {HDR}, b = {HDR}, all = {HDR};
+    a.insert(a.end(), shardA.begin(), shardA.end());
+    b.insert(b.end(), shardB.begin(), shardB.end());
+    all.insert(all.end(), shardA.begin(), shardA.end());
+    all.insert(all.end(), shardB.begin(), shardB.end());
+    writeFile("d3a.csv", a);
+    writeFile("d3b.csv", b);
+    writeFile("d3all.csv", all);
+
+    TripAnalyzer ta, tb, whole;
+    ta.ingestFile("d3a.csv");
+    tb.ingestFile("d3b.csv");
+    whole.ingestFile("d3all.csv");
+
+    REQUIRE(ta.saveSnapshot("d3a.snap"));
+    REQUIRE(tb.saveSnapshot("d3b.snap"));
+    REQUIRE(mergeSnapshotFiles({"d3a.snap", "d3b.snap"}, "d3.snap"));
+
+    ta.merge(tb);
+    TripAnalyzer fromSnap;
+    REQUIRE(fromSnap.loadSnapshot("d3.snap"));
+
+    for (const TripAnalyzer* m : {&ta, &fromSnap}) {
+        auto topZ = m->topZones(10);
+        auto wantZ = whole.topZones(10);
+        REQUIRE(topZ.size() == wantZ.size());
+        for (size_t i = 0; i < topZ.size(); ++i) {
+            REQUIRE(topZ[i].zone == wantZ[i].zone);
+            REQUIRE(topZ[i].count == wantZ[i].count);
+        }
+        auto topS = m->topBusySlots(10);
+        auto wantS = whole.topBusySlots(10);
+        REQUIRE(topS.size() == wantS.size());
+        for (size_t i = 0; i < topS.size(); ++i) {
+            REQUIRE(topS[i].zone == wantS[i].zone);
+            REQUIRE(topS[i].hour == wantS[i].hour);
+            REQUIRE(topS[i].count == wantS[i].count);
+        }
+    }
+    REQUIRE(hasZone(fromSnap.topZones(10), "ZONE_B", 3));
+
+    // A merge that fails part way leaves the previous output untouched.
+    {
+        std::ifstream in("d3a.snap", std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out("d3cut.snap", std::ios::binary);
+        out.write(bytes.data(), bytes.size() - 4);
+    }
+    REQUIRE_FALSE(mergeSnapshotFiles({"d3cut.snap", "d3b.snap"}, "d3.snap"));
+    REQUIRE_FALSE(std::ifstream("d3.snap.tmp").good());
+    TripAnalyzer kept;
+    REQUIRE(kept.loadSnapshot("d3.snap"));
+    REQUIRE(hasZone(kept.topZones(10), "ZONE_B", 3));
+
+    for (const char* f : {"d3a.csv", "d3b.csv", "d3all.csv", "d3a.snap", "d3b.snap", "d3.snap", "d3cut.snap"})
+        std::remove(f);
+}
+
+TEST_CASE("D4 read modes and multi-file ingest", "[D4]") {
+    // Same rows through every reader; the last row has no trailing newline.
+    {
+        std::ofstream out("d4a.csv");
+        out << HDR << "\n"
+            << "1,ZONE_A,ZX,2024-01-01 09:15,1,1\n"
+            << "2,,ZX,2024-01-01 09:15,1,1\n"
+            << "3,ZONE_B,ZX,2024-01-01 23:59,1,1\n"
+            << "4,ZONE_A,ZX,2024-01-01 09:40,1,1";
+    }
+    writeFile("d4b.csv", {HDR, "5,ZONE_B,ZX,2024-01-01 23:00,1,1", "6,ZONE_C,ZX,2024-01-01 00:00,1,1"});
+
+    for (ReadMode rm : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        for (int threads : {1, 2}) {
+            TripAnalyzer ta;
+            ta.setReadMode(rm);
+            ta.setThreads(threads);
+            ta.ingestFile("d4a.csv");
+            REQUIRE(hasZone(ta.topZones(10), "ZONE_A", 2));
+            REQUIRE(hasSlot(ta.topBusySlots(10), "ZONE_A", 9, 2));
+            REQUIRE(ta.stats().rowsRead == 4);
+            REQUIRE(ta.stats().rowsMalformed == 1);
+
+            ta.ingestFiles({"d4a.csv", "d4b.csv", "missing_d4.csv"});
+            auto topZ = ta.topZones(10);
+            REQUIRE(topZ.size() == 3);
+            REQUIRE(topZ[0].zone == "ZONE_A");
+            REQUIRE(topZ[1].zone == "ZONE_B");
+            REQUIRE(topZ[1].count == 2);
+            REQUIRE(hasSlot(ta.topBusySlots(10), "ZONE_B", 23, 2));
+            REQUIRE(ta.stats().filesRead == 2);
+        }
+    }
+    std::remove("d4a.csv");
+    std::remove("d4b.csv");
+}
+
+TEST_CASE("D5 ISA kernel variants agree", "[D5]") {
+    const ScanKernels* scalar = kernelsByName("scalar");
+    REQUIRE(scalar != nullptr);
+
+    // Rows of every length 0..150 at every alignment within a page-aligned
+    // buffer, including rows that end exactly at a page boundary.
+    std::vector<char> page(3 * 4096 + 4096);
+    char* base = page.data() + (4096 - ((uintptr_t)page.data() & 4095));
+    for (size_t i = 0; i < 3 * 4096; ++i) base[i] = "a,b,\n,1234567"[(i * 7 + i / 13) % 13];
+
+    for (const char* name : {"sse42", "avx2", "avx512"}) {
+        const ScanKernels* k = kernelsByName(name);
+        if (!k) continue;
+        for (size_t len = 0; len <= 150; ++len) {
+            for (size_t start : {size_t(0), size_t(1), size_t(17), size_t(4096 - len), size_t(4096 - len / 2)}) {
+                const char* b = base + start;
+                uint32_t want[8], got[8];
+                int nw = scalar->findCommas(b, b + len, want, 8);
+                int ng = k->findCommas(b, b + len, got, 8);
+                REQUIRE(ng == nw);
+                for (int i = 0; i < nw; ++i) REQUIRE(got[i] == want[i]);
+                REQUIRE(k->findNewline(b, b + len) == scalar->findNewline(b, b + len));
+            }
+        }
+        for (const char* ts : {"2024-01-01 00:00", "2024-01-01 23:59", "2024-01-01 24:00",
+                               "2024-01-01 9X:00", "2024-01-01 /9:00", "2024-01-01 :0:00"})
+            REQUIRE(k->parseHour(ts) == scalar->parseHour(ts));
+    }
+    REQUIRE(scalar->parseHour("2024-01-01 23:59") == 23);
+    REQUIRE(scalar->parseHour("2024-01-01 9X:00") == -1);
+    REQUIRE(scalar->parseHour("2024-01-01 24:00") == -1);
+}
+
+TEST_CASE("D6 profiling mode", "[D6]") {
+    const std::string path = "d6.csv";
+    writeFile(path, {HDR, "1,ZONE_A,ZX,2024-01-01 09:15,1,1", "2,ZONE_B,ZX,2024-01-01 10:15,1,1",
+                     "3,ZONE_A,ZX,2024-01-01 09:45,1,1"});
+
+    TripAnalyzer ta;
+    ta.setProfiling(true);
+    ta.ingestFile(path);
+    auto topZ = ta.topZones(1);
+    REQUIRE(topZ.size() == 1);
+    REQUIRE(topZ[0].zone == "ZONE_A");
+    REQUIRE(topZ[0].count == 2);
+
+    // Counters may be unavailable (containers, VMs); when present they
+    // must have measured something.
+    const PhaseProfile& p = ta.profile();
+    if (p.ingest.has(PerfSample::Instructions)) REQUIRE(p.ingest.instructions() > 0);
+    if (p.sort.has(PerfSample::Cycles)) REQUIRE(p.sort.cycles() > 0);
+
+    // Copies (e.g. per-thread workers) must not share counter descriptors.
+    TripAnalyzer copy = ta;
+    copy.ingestFile(path);
+    REQUIRE(hasZone(copy.topZones(10), "ZONE_B", 1));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D7 steady-state ingest allocations", "[D7]") {
+    const std::string path = "d7.csv";
+    const int rows = 500000;
+
+    // 2000 zones with names past the small-string buffer, so any per-row
+    // std::string would show up as an allocation.
+    {
+        std::ofstream out(path);
+        REQUIRE(out.is_open());
+        out << HDR << "\n";
+        char buf[96];
+        for (int i = 0; i < rows; ++i) {
+            std::snprintf(buf, sizeof(buf), "%d,LONG_ZONE_IDENTIFIER_%04d,ZX,2024-01-01 %02d:15,1,1\n",
+                          i + 1, (int)((i * 7919LL) % 2000), i % 24);
+            out << buf;
+        }
+    }
+
+    for (ReadMode rm : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        TripAnalyzer ta;
+        ta.setReadMode(rm);
+        ta.setDedup(true);
+        long long before = g_allocations.load();
+        ta.ingestFile(path);
+        long long allocs = g_allocations.load() - before;
+        long long perMillion = allocs * 1000000LL / rows;
+
+        INFO("read mode " << (int)rm << ": " << allocs << " allocations, "
+             << perMillion << " per million rows");
+        REQUIRE(ta.stats().rowsAccepted == rows);
+        // Only amortised growth of the dictionary, counters and dedup
+        // pages may allocate; anything per-row would be ~1e6 here.
+        REQUIRE(perMillion < 250);
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D8 hugepage-backed tables", "[D8]") {
+    const std::string path = "d8.csv";
+    {
+        // 20k zones: the hour matrix (192 B per zone) crosses the mmap threshold.
+        std::ofstream out(path);
+        REQUIRE(out.is_open());
+        out << HDR << "\n";
+        for (int i = 0; i < 40000; ++i)
+            out << i + 1 << ",ZONE_" << (i % 20000) << ",ZX,2024-01-01 " << (i % 2 ? "07" : "19") << ":00,1,1\n";
+        out << "40001,ZONE_7,ZX,2024-01-01 19:30,1,1\n";
+    }
+
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    auto wantZ = plain.topZones(5);
+    auto wantS = plain.topBusySlots(5);
+
+    for (HugePagePolicy policy : {HugePagePolicy::Transparent, HugePagePolicy::Explicit}) {
+        HugePageUsage before = hugePageUsage();
+        {
+            TripAnalyzer ta;
+            ta.setHugePages(policy);
+            ta.ingestFile(path);
+            HugePageUsage during = hugePageUsage();
+            REQUIRE(during.explicitBytes + during.transparentBytes + during.regularBytes >
+                    before.explicitBytes + before.transparentBytes + before.regularBytes);
+
+            auto topZ = ta.topZones(5);
+            auto topS = ta.topBusySlots(5);
+            REQUIRE(topZ.size() == wantZ.size());
+            for (size_t i = 0; i < topZ.size(); ++i) {
+                REQUIRE(topZ[i].zone == wantZ[i].zone);
+                REQUIRE(topZ[i].count == wantZ[i].count);
+            }
+            REQUIRE(topS.size() == wantS.size());
+            for (size_t i = 0; i < topS.size(); ++i) {
+                REQUIRE(topS[i].zone == wantS[i].zone);
+                REQUIRE(topS[i].hour == wantS[i].hour);
+            }
+            REQUIRE(topZ[0].zone == "ZONE_7");
+            REQUIRE(topZ[0].count == 3);
+        }
+        HugePageUsage after = hugePageUsage();
+        REQUIRE(after.explicitBytes == before.explicitBytes);
+        REQUIRE(after.transparentBytes == before.transparentBytes);
+        REQUIRE(after.regularBytes == before.regularBytes);
+    }
+
+    // Off never maps, and a table replaced by one of another policy hands
+    // its mapping back through the allocator that made it.
+    auto mappedBytes = [] {
+        HugePageUsage u = hugePageUsage();
+        return u.explicitBytes + u.transparentBytes + u.regularBytes;
+    };
+    size_t base = mappedBytes();
+    {
+        TripAnalyzer off;
+        off.ingestFile(path);
+        REQUIRE(mappedBytes() == base);
+    }
+    HugeVector<long long> table(1 << 18, 1, HugePageAllocator<long long>(HugePagePolicy::Transparent));
+    REQUIRE(mappedBytes() > base);
+    REQUIRE(table.get_allocator() != HugePageAllocator<long long>(HugePagePolicy::Off));
+    table = HugeVector<long long>(1 << 18, 2, HugePageAllocator<long long>(HugePagePolicy::Off));
+    REQUIRE(mappedBytes() == base);
+    REQUIRE(table.get_allocator().policy == HugePagePolicy::Off);
+    REQUIRE(table[5] == 2);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D9 narrow slot counters promote exactly", "[D9]") {
+    const std::string path = "d9.csv";
+    {
+        std::ofstream out(path);
+        REQUIRE(out.is_open());
+        out << HDR << "\n";
+        long long id = 1;
+        // 70000 > 65535 forces the (ZONE_BIG, 5) cell into the side table;
+        // 65534 and 65535 sit right at the promotion boundary.
+        for (int i = 0; i < 70000; ++i, ++id) out << id << ",ZONE_BIG,ZX,2024-01-01 05:00,1,1\n";
+        for (int i = 0; i < 65535; ++i, ++id) out << id << ",ZONE_BIG,ZX,2024-01-01 06:00,1,1\n";
+        for (int i = 0; i < 65534; ++i, ++id) out << id << ",ZONE_EDGE,ZX,2024-01-01 06:00,1,1\n";
+    }
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+    auto topS = ta.topBusySlots(3);
+    REQUIRE(topS.size() == 3);
+    REQUIRE(topS[0].zone == "ZONE_BIG");
+    REQUIRE(topS[0].hour == 5);
+    REQUIRE(topS[0].count == 70000);
+    REQUIRE(topS[1].zone == "ZONE_BIG");
+    REQUIRE(topS[1].hour == 6);
+    REQUIRE(topS[1].count == 65535);
+    REQUIRE(topS[2].zone == "ZONE_EDGE");
+    REQUIRE(topS[2].count == 65534);
+    REQUIRE(hasZone(ta.topZones(2), "ZONE_BIG", 135535));
+
+    // Merging and snapshot round trips carry wide counts across.
+    TripAnalyzer twice;
+    twice.ingestFile(path);
+    twice.merge(ta);
+    REQUIRE(hasSlot(twice.topBusySlots(3), "ZONE_BIG", 5, 140000));
+    REQUIRE(hasSlot(twice.topBusySlots(3), "ZONE_EDGE", 6, 131068));
+    REQUIRE(twice.saveSnapshot("d9.snap"));
+    TripAnalyzer reloaded;
+    REQUIRE(reloaded.loadSnapshot("d9.snap"));
+    REQUIRE(hasSlot(reloaded.topBusySlots(3), "ZONE_BIG", 6, 131070));
+
+    std::remove(path.c_str());
+    std::remove("d9.snap");
+}
+
+TEST_CASE("D10 batched ingest matches row-at-a-time", "[D10]") {
+    // 1000 zones with new zones, duplicates and dirty rows landing inside
+    // and across the 32-row batches of the buffered readers.
+    const std::string path = "d10.csv";
+    {
+        std::ofstream out(path);
+        REQUIRE(out.is_open());
+        out << HDR << "\n";
+        for (int i = 0; i < 5000; ++i) {
+            int id = i % 7 == 3 ? i - 1 : i;
+            if (i % 97 == 5) out << id << ",,ZX,2024-01-01 10:00,1,1\n";
+            else out << id << ",Z" << (i * 37) % 1000 << ",ZX,2024-01-01 " << (i % 24 < 10 ? "0" : "") << i % 24 << ":00,1,1\n";
+        }
+    }
+
+    for (bool dedup : {false, true}) {
+        TripAnalyzer ref;
+        ref.setDedup(dedup);
+        ref.ingestFile(path);
+        auto refZ = ref.topZones(50);
+        auto refS = ref.topBusySlots(50);
+        for (ReadMode rm : {ReadMode::Mmap, ReadMode::Stream}) {
+            TripAnalyzer ta;
+            ta.setDedup(dedup);
+            ta.setReadMode(rm);
+            ta.ingestFile(path);
+            REQUIRE(ta.stats().rowsAccepted == ref.stats().rowsAccepted);
+            REQUIRE(ta.stats().duplicatesRejected == ref.stats().duplicatesRejected);
+            auto topZ = ta.topZones(50);
+            auto topS = ta.topBusySlots(50);
+            REQUIRE(topZ.size() == refZ.size());
+            REQUIRE(topS.size() == refS.size());
+            for (size_t i = 0; i < topZ.size(); ++i) {
+                REQUIRE(topZ[i].zone == refZ[i].zone);
+                REQUIRE(topZ[i].count == refZ[i].count);
+            }
+            for (size_t i = 0; i < topS.size(); ++i) {
+                REQUIRE(topS[i].zone == refS[i].zone);
+                REQUIRE(topS[i].hour == refS[i].hour);
+                REQUIRE(topS[i].count == refS[i].count);
+            }
+        }
+        if (dedup) REQUIRE(ref.stats().duplicatesRejected > 0);
+    }
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D11 numeric-suffix zone IDs", "[D11]") {
+    // The first zone fixes the "ZONE" + 3 digits scheme; lookalikes with
+    // another width, case or prefix must stay distinct zones.
+    ZoneTable table;
+    uint32_t a = table.findOrInsert("ZONE042");
+    REQUIRE(table.findOrInsert("ZONE42") != a);
+    REQUIRE(table.findOrInsert("zone042") != a);
+    REQUIRE(table.findOrInsert("ZONE0042") != a);
+    REQUIRE(table.findOrInsert("ZONEX42") != a);
+    REQUIRE(table.findOrInsert("ZONE04a") != a);
+    REQUIRE(table.findOrInsert("ZONE042") == a);
+    REQUIRE(table.findOrInsert("ZONE999") == 6);
+    REQUIRE(table.size() == 7);
+    REQUIRE(table.directZones() == 2);
+    REQUIRE(table.find("ZONE999") == 6);
+    REQUIRE(table.find("ZONE998") == ZoneTable::kNone);
+    REQUIRE(table.find("zone042") == 2);
+    REQUIRE(table.name(6) == "ZONE999");
+
+    writeFile("d11.csv", {
+        HDR,
+        "1,ZONE007,ZX,2024-01-01 05:00,1,1",
+        "2,ZONE7,ZX,2024-01-01 05:00,1,1",
+        "3,zone007,ZX,2024-01-01 05:00,1,1",
+        "4,ZONE005,ZX,2024-01-01 05:00,1,1",
+        "5,ZONE007,ZX,2024-01-01 06:00,1,1",
+        "6,ZONE005,ZX,2024-01-01 06:00,1,1",
+        "7,ZONE7,ZX,2024-01-01 05:00,1,1"
+    });
+    for (ReadMode rm : {ReadMode::Getline, ReadMode::Mmap}) {
+        TripAnalyzer ta;
+        ta.setReadMode(rm);
+        ta.ingestFile("d11.csv");
+        auto topZ = ta.topZones(10);
+        REQUIRE(topZ.size() == 4);
+        REQUIRE(topZ[0].zone == "ZONE005");
+        REQUIRE(topZ[1].zone == "ZONE007");
+        REQUIRE(topZ[2].zone == "ZONE7");
+        REQUIRE(topZ[2].count == 2);
+        REQUIRE(topZ[3].zone == "zone007");
+        auto topS = ta.topBusySlots(2);
+        REQUIRE(topS[0].zone == "ZONE7");
+        REQUIRE(topS[0].hour == 5);
+        REQUIRE(topS[1].zone == "ZONE005");
+    }
+    std::remove("d11.csv");
+}
+
+TEST_CASE("D12 perfect-hash zone catalog", "[D12]") {
+    ZoneCatalog big;
+    std::vector<std::string> names;
+    for (int i = 0; i < 100000; ++i) names.push_back("Z" + std::to_string(i * 7));
+    names.push_back("Z0");   // duplicates collapse
+    REQUIRE(big.build(names));
+    REQUIRE(big.size() == 100000);
+    std::vector<bool> seen(big.size(), false);
+    int misplaced = 0;
+    for (int i = 0; i < 100000; ++i) {
+        uint32_t pos = big.find("Z" + std::to_string(i * 7));
+        if (pos >= big.size() || seen[pos]) ++misplaced;
+        else seen[pos] = true;
+    }
+    REQUIRE(misplaced == 0);
+    REQUIRE(big.find("Z1") == ZoneCatalog::kNone);
+    REQUIRE(big.find("z0") == ZoneCatalog::kNone);
+    REQUIRE_FALSE(ZoneCatalog().build({}));
+
+    writeFile("d12.cat", {"ZONE_B", "ZONE_A", "", "ZONE_Z"});
+    writeFile("d12.csv", {
+        HDR,
+        "1,ZONE_B,ZX,2024-01-01 05:00,1,1",
+        "2,ZONE_A,ZX,2024-01-01 05:00,1,1",
+        "3,OTHER,ZX,2024-01-01 05:00,1,1",
+        "4,zone_a,ZX,2024-01-01 06:00,1,1",
+        "5,ZONE_A,ZX,2024-01-01 07:00,1,1",
+        "6,OTHER,ZX,2024-01-01 05:00,1,1",
+        "7,,ZX,2024-01-01 05:00,1,1"
+    });
+
+    TripAnalyzer missing;
+    REQUIRE_FALSE(missing.loadZoneCatalog("missing_d12.cat"));
+
+    for (ReadMode rm : {ReadMode::Getline, ReadMode::Mmap}) {
+        TripAnalyzer fallback;
+        fallback.setReadMode(rm);
+        fallback.setThreads(2);
+        REQUIRE(fallback.loadZoneCatalog("d12.cat"));
+        fallback.ingestFile("d12.csv");
+        auto topZ = fallback.topZones(10);
+        REQUIRE(topZ.size() == 4);   // ZONE_Z never appears
+        REQUIRE(topZ[0].zone == "OTHER");
+        REQUIRE(topZ[1].zone == "ZONE_A");
+        REQUIRE(topZ[2].zone == "ZONE_B");
+        REQUIRE(topZ[3].zone == "zone_a");
+        REQUIRE(hasSlot(fallback.topBusySlots(10), "OTHER", 5, 2));
+        REQUIRE(fallback.stats().rowsMalformed == 1);
+        REQUIRE(fallback.stats().unknownZones == 0);
+
+        TripAnalyzer reject;
+        reject.setReadMode(rm);
+        REQUIRE(reject.loadZoneCatalog("d12.cat", UnknownZonePolicy::Reject));
+        reject.ingestFile("d12.csv");
+        topZ = reject.topZones(10);
+        REQUIRE(topZ.size() == 2);
+        REQUIRE(hasZone(topZ, "ZONE_A", 2));
+        REQUIRE(hasZone(topZ, "ZONE_B", 1));
+        REQUIRE(reject.stats().unknownZones == 3);
+        REQUIRE(reject.stats().rowsMalformed == 1);
+        REQUIRE(reject.stats().rowsAccepted == 3);
+
+        // Snapshots carry only zones with trips, and reload into the catalog.
+        REQUIRE(fallback.saveSnapshot("d12.snap"));
+        REQUIRE(reject.loadSnapshot("d12.snap"));
+        REQUIRE(reject.topZones(10).size() == 4);
+        REQUIRE(hasZone(reject.topZones(10), "ZONE_B", 1));
+    }
+    std::remove("d12.cat");
+    std::remove("d12.csv");
+    std::remove("d12.snap");
+}
+
+TEST_CASE("D13 spill to disk under a memory budget", "[D13]") {
+    const std::string path = "d13.csv";
+    {
+        std::ofstream out(path);
+        REQUIRE(out.is_open());
+        out << HDR << "\n";
+        for (int i = 0; i < 20000; ++i) {
+            int zone = i % 3 == 0 ? i % 7 : (int)((i * 7919LL) % 3000);
+            out << i << ",Z" << zone << ",ZX,2024-01-01 " << (i % 24 < 10 ? "0" : "") << i % 24 << ":00,1,1\n";
+        }
+    }
+    TripAnalyzer ref;
+    ref.ingestFile(path);
+    auto refZ = ref.topZones(100);
+    auto refS = ref.topBusySlots(100);
+
+    for (int threads : {1, 2}) {
+        TripAnalyzer ta;
+        ta.setReadMode(ReadMode::Mmap);
+        ta.setThreads(threads);
+        ta.setMemoryBudget(1, ".");   // smallest table: a spill every few batches
+        ta.ingestFile(path);
+        REQUIRE(ta.stats().spillRuns > 10);
+        REQUIRE(ta.stats().rowsAccepted == 20000);
+
+        auto topZ = ta.topZones(100);
+        auto topS = ta.topBusySlots(100);
+        REQUIRE(topZ.size() == refZ.size());
+        REQUIRE(topS.size() == refS.size());
+        for (size_t i = 0; i < topZ.size(); ++i) {
+            REQUIRE(topZ[i].zone == refZ[i].zone);
+            REQUIRE(topZ[i].count == refZ[i].count);
+        }
+        for (size_t i = 0; i < topS.size(); ++i) {
+            REQUIRE(topS[i].zone == refS[i].zone);
+            REQUIRE(topS[i].hour == refS[i].hour);
+            REQUIRE(topS[i].count == refS[i].count);
+        }
+        REQUIRE(ta.topZones(0).empty());
+
+        // The merged view is what gets saved.
+        REQUIRE(ta.saveSnapshot("d13.snap"));
+        TripAnalyzer loaded;
+        REQUIRE(loaded.loadSnapshot("d13.snap"));
+        REQUIRE(loaded.topZones(5000).size() == ref.topZones(5000).size());
+        REQUIRE(hasZone(loaded.topZones(1), refZ[0].zone, refZ[0].count));
+    }
+
+    // Runs are removed with their last owner.
+    REQUIRE(std::system("ls trip-spill-* > /dev/null 2>&1") != 0);
+
+    // Past the fan-in the runs are merged into one, so few stay open; a
+    // run that is damaged or gone fails the queries rather than dropping
+    // its zones.
+    namespace fs = std::filesystem;
+    const fs::path runDir = "d13-runs";
+    for (int threads : {1, 2}) {
+        fs::create_directory(runDir);
+        TripAnalyzer ta;
+        ta.setReadMode(ReadMode::Mmap);
+        ta.setThreads(threads);
+        ta.setMemoryBudget(1, runDir.string());
+        ta.ingestFile(path);
+        REQUIRE(ta.stats().spillRuns > 64);
+        REQUIRE(!ta.stats().spillFailed);
+        auto files = std::distance(fs::directory_iterator(runDir), fs::directory_iterator());
+        REQUIRE(files > 0);
+        REQUIRE(files <= 64);
+        auto topZ = ta.topZones(100);
+        REQUIRE(topZ.size() == refZ.size());
+        for (size_t i = 0; i < topZ.size(); ++i) REQUIRE(topZ[i].count == refZ[i].count);
+        REQUIRE(!ta.spillReadFailed());
+
+        fs::path run = fs::directory_iterator(runDir)->path();
+        if (threads == 1) fs::resize_file(run, fs::file_size(run) / 2);
+        else fs::remove(run);
+        REQUIRE(ta.topZones(100).empty());
+        REQUIRE(ta.topBusySlots(100).empty());
+        REQUIRE(ta.spillReadFailed());
+        REQUIRE(!ta.saveSnapshot("d13.snap"));
+        fs::remove_all(runDir);
+    }
+
+    // Nowhere to spill: ingest stops instead of running on without a cap.
+    for (int threads : {1, 2}) {
+        TripAnalyzer ta;
+        ta.setReadMode(ReadMode::Mmap);
+        ta.setThreads(threads);
+        ta.setMemoryBudget(1, "./d13-no-such-dir");
+        ta.ingestFile(path);
+        REQUIRE(ta.stats().spillFailed);
+        REQUIRE(ta.stats().spillRuns == 0);
+        REQUIRE(ta.stats().rowsAccepted < 20000);
+    }
+    std::remove(path.c_str());
+    std::remove("d13.snap");
+}
+
+TEST_CASE("D14 sliding-window top-k", "[D14]") {
+    REQUIRE(WindowAnalyzer::parseMinute("1970-01-01 00:00") == 0);
+    REQUIRE(WindowAnalyzer::parseMinute("2024-03-01 01:02") == (19783LL * 24 + 1) * 60 + 2);
+    REQUIRE(WindowAnalyzer::parseMinute("2024-01-01 24:00") == -1);
+    REQUIRE(WindowAnalyzer::parseMinute("2024-01-01 9:15") == -1);
+
+    WindowAnalyzer w(60);
+    REQUIRE(w.ingestLine("1,ZONE_B,ZX,2024-01-01 09:00,1,1"));
+    REQUIRE(w.ingestLine("2,ZONE_A,ZX,2024-01-01 09:30,1,1"));
+    REQUIRE(w.ingestLine("3,ZONE_A,ZX,2024-01-01 09:10,1,1"));   // out of order, in window
+    REQUIRE(w.ingestLine("4,ZONE_B,ZX,2024-01-01 09:59,1,1"));
+    REQUIRE_FALSE(w.ingestLine("5,ZONE_B,ZX,2024-01-01 xx:00,1,1"));
+    auto topZ = w.topZones(10);
+    REQUIRE(topZ.size() == 2);
+    REQUIRE(topZ[0].zone == "ZONE_A");   // 2-2 tie broken by name
+    REQUIRE(topZ[1].count == 2);
+
+    // 10:00 pushes 09:00 out; 08:59 is now too late.
+    REQUIRE(w.ingestLine("6,ZONE_C,ZX,2024-01-01 10:00,1,1"));
+    REQUIRE_FALSE(w.ingestLine("7,ZONE_C,ZX,2024-01-01 09:00,1,1"));
+    REQUIRE(w.rowsLate() == 1);
+    REQUIRE(hasZone(w.topZones(10), "ZONE_B", 1));
+    REQUIRE(hasSlot(w.topBusySlots(10), "ZONE_A", 9, 2));
+    REQUIRE(w.rowsInWindow() == 4);
+
+    // A jump past the whole window empties it.
+    REQUIRE(w.ingestLine("8,ZONE_D,ZX,2024-01-02 10:00,1,1"));
+    REQUIRE(w.topZones(10).size() == 1);
+    REQUIRE(w.topBusySlots(10).size() == 1);
+
+    // Random stream with jitter against a brute-force recount of the window.
+    WindowAnalyzer r(30);
+    std::vector<std::pair<std::string, long long>> accepted;
+    uint64_t x = 12345;
+    long long t = 1000000;
+    for (int i = 0; i < 20000; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        t += (long long)(x >> 61);                   // 0..7 minutes forward
+        long long minute = t - (long long)((x >> 20) % 40);
+        std::string zone = "Z" + std::to_string((x >> 33) % 50);
+        if (r.add(zone, minute)) accepted.push_back({zone, minute});
+
+        if (i % 997 == 0) {
+            std::map<std::string, long long> zc;
+            std::map<std::pair<std::string, int>, long long> sc;
+            for (const auto& a : accepted) {
+                if (a.second <= r.now() - 30) continue;
+                ++zc[a.first];
+                ++sc[{a.first, (int)(a.second / 60 % 24)}];
+            }
+            auto got = r.topZones(1000);
+            REQUIRE(got.size() == zc.size());
+            for (size_t j = 0; j < got.size(); ++j) {
+                REQUIRE(got[j].count == zc[got[j].zone]);
+                if (j > 0) REQUIRE((got[j - 1].count > got[j].count ||
+                                    (got[j - 1].count == got[j].count && got[j - 1].zone < got[j].zone)));
+            }
+            auto slots = r.topBusySlots(1000);
+            REQUIRE(slots.size() == sc.size());
+            for (const auto& s : slots) REQUIRE(s.count == sc[{s.zone, s.hour}]);
+        }
+    }
+}
+
+TEST_CASE("D15 compile-time group-by engine", "[D15]") {
+    static_assert(std::is_same<Keys<PickupZone>::Packed, uint32_t>::value, "");
+    static_assert(std::is_same<Keys<PickupZone, Hour>::Packed, uint64_t>::value, "");
+    static_assert(std::is_same<Keys<PickupZone, DropoffZone, Hour>::Packed, unsigned __int128>::value, "");
+
+    // The built-in queries are the Count instantiations over zone and
+    // zone x hour; on the sample data they must agree exactly.
+    TripRowDecoder decoder;
+    GroupBy<Keys<PickupZone>, Count> byZone;
+    GroupBy<Keys<PickupZone, Hour>, Count> bySlot;
+    REQUIRE(decoder.scanFile("SmallTrips.csv", [&](const TripRow& r) {
+        byZone.add(r);
+        bySlot.add(r);
+    }));
+    TripAnalyzer ta;
+    ta.ingestFile("SmallTrips.csv");
+    auto topZ = ta.topZones(25);
+    auto gz = byZone.top(25, decoder.zones());
+    REQUIRE(gz.size() == topZ.size());
+    for (size_t i = 0; i < gz.size(); ++i) {
+        REQUIRE(decoder.zones().name((uint32_t)byZone.field<0>(gz[i].key)) == topZ[i].zone);
+        REQUIRE(std::get<0>(gz[i].values) == topZ[i].count);
+    }
+    auto topS = ta.topBusySlots(25);
+    auto gs = bySlot.top(25, decoder.zones());
+    REQUIRE(gs.size() == topS.size());
+    for (size_t i = 0; i < gs.size(); ++i) {
+        REQUIRE(decoder.zones().name((uint32_t)bySlot.field<0>(gs[i].key)) == topS[i].zone);
+        REQUIRE((int)bySlot.field<1>(gs[i].key) == topS[i].hour);
+        REQUIRE(std::get<0>(gs[i].values) == topS[i].count);
+    }
+
+    // Other dimensions and measures; 2024-01-01 was a Monday.
+    writeFile("d15.csv", {
+        HDR,
+        "1,ZA,ZB,2024-01-01 09:00,2.5,10.0",
+        "2,ZA,ZB,2024-01-08 10:00,1.5,20.0",
+        "3,ZA,ZC,2024-01-02 11:00,1.0,5.5",
+        "4,ZC,ZB,2024-13-40 12:00,1.0,7.0",    // bad date: no weekday/date key
+        "5,ZA,ZB,2024-01-01 25:00,1.0,1.0"     // rejected like TripAnalyzer
+    });
+    TripRowDecoder dec;
+    GroupBy<Keys<DropoffZone, Weekday>, Count, SumFare, SumDistance> byDrop;
+    GroupBy<Keys<Date>, Count> byDate;
+    GroupBy<Keys<PickupZone, DropoffZone, Hour>, Count> byRoute;
+    int rows = 0;
+    REQUIRE(dec.scanFile("d15.csv", [&](const TripRow& r) {
+        ++rows;
+        byDrop.add(r);
+        byDate.add(r);
+        byRoute.add(r);
+    }));
+    REQUIRE(rows == 4);
+    auto drop = byDrop.top<1>(10, dec.zones());    // by fare
+    REQUIRE(drop.size() == 2);
+    REQUIRE(dec.zones().name((uint32_t)byDrop.field<0>(drop[0].key)) == "ZB");
+    REQUIRE(byDrop.field<1>(drop[0].key) == 0);
+    REQUIRE(std::get<0>(drop[0].values) == 2);
+    REQUIRE(std::get<1>(drop[0].values) == Catch::Approx(30.0));
+    REQUIRE(std::get<2>(drop[0].values) == Catch::Approx(4.0));
+    REQUIRE(byDrop.field<1>(drop[1].key) == 1);
+    REQUIRE(byDate.size() == 3);
+    REQUIRE(byDate.field<0>(byDate.top(1, dec.zones())[0].key) == 19723);
+    auto routes = byRoute.top(10, dec.zones());
+    REQUIRE(routes.size() == 4);
+    REQUIRE(byRoute.field<2>(routes[0].key) == 9);   // all 1s: ZA,ZB,9 sorts first
+
+    GroupBy<Keys<DropoffZone, Weekday>, Count, SumFare, SumDistance> twice = byDrop;
+    twice.merge(byDrop);
+    REQUIRE(std::get<0>(twice.top(1, dec.zones())[0].values) == 4);
+    std::remove("d15.csv");
+}
+
+TEST_CASE("D16 runtime query plan", "[D16]") {
+    AggregateSpec spec;
+    REQUIRE(parseAggregateSpec("pickup,hour:count:7", spec));
+    REQUIRE(spec.keys.size() == 2);
+    REQUIRE(spec.keys[1] == Dimension::Hour);
+    REQUIRE(spec.k == 7);
+    REQUIRE(parseAggregateSpec("dropoff,weekday:fare", spec));
+    REQUIRE(spec.measure == Measure::SumFare);
+    REQUIRE(spec.k == 10);
+    REQUIRE_FALSE(parseAggregateSpec("pickup", spec));
+    REQUIRE_FALSE(parseAggregateSpec("zone:count", spec));
+    REQUIRE_FALSE(parseAggregateSpec("pickup:sum", spec));
+    REQUIRE_FALSE(parseAggregateSpec("pickup:count:x", spec));
+    REQUIRE_FALSE(parseAggregateSpec(":count", spec));
+
+    // The built-in queries as plan entries, answered from one scan.
+    QueryPlan plan;
+    AggregateSpec zones, slots;
+    REQUIRE(parseAggregateSpec("pickup:count:25", zones));
+    REQUIRE(parseAggregateSpec("pickup,hour:count:25", slots));
+    REQUIRE(plan.add(zones) == 0);
+    REQUIRE(plan.add(slots) == 1);
+    AggregateSpec dup;
+    REQUIRE(parseAggregateSpec("pickup,pickup:count", dup));
+    REQUIRE(plan.add(dup) == -1);
+    REQUIRE(plan.ingestFile("SmallTrips.csv"));
+    TripAnalyzer ta;
+    ta.ingestFile("SmallTrips.csv");
+    REQUIRE(plan.rowsAccepted() == ta.stats().rowsAccepted);
+    auto topZ = ta.topZones(25);
+    auto pz = plan.result(0);
+    REQUIRE(pz.size() == topZ.size());
+    for (size_t i = 0; i < pz.size(); ++i) {
+        REQUIRE(pz[i].key == std::vector<std::string>{topZ[i].zone});
+        REQUIRE(pz[i].value == topZ[i].count);
+    }
+    auto topS = ta.topBusySlots(25);
+    auto ps = plan.result(1);
+    REQUIRE(ps.size() == topS.size());
+    for (size_t i = 0; i < ps.size(); ++i) {
+        REQUIRE(ps[i].key == std::vector<std::string>{topS[i].zone, std::to_string(topS[i].hour)});
+        REQUIRE(ps[i].value == topS[i].count);
+    }
+    REQUIRE(plan.add(zones) == -1);   // plan is fixed once ingest starts
+
+    writeFile("d16.csv", {
+        HDR,
+        "1,ZA,ZB,2024-01-01 09:00,2.5,10.0",
+        "2,ZA,ZB,2024-01-08 10:00,1.5,20.0",
+        "3,ZA,ZC,2024-01-02 11:00,1.0,5.5",
+        "4,ZC,ZB,2024-13-40 12:00,1.0,7.0",
+        "5,ZA,ZB,2024-01-01 25:00,1.0,1.0"
+    });
+    QueryPlan mixed;
+    const char* specs[] = {"dropoff,weekday:fare", "date:count", "pickup:distance:1"};
+    for (const char* s : specs) {
+        REQUIRE(parseAggregateSpec(s, spec));
+        REQUIRE(mixed.add(spec) >= 0);
+    }
+    REQUIRE(mixed.ingestFile("d16.csv"));
+    REQUIRE(mixed.rowsRead() == 5);
+    REQUIRE(mixed.rowsAccepted() == 4);
+    auto fare = mixed.result(0);
+    REQUIRE(fare.size() == 2);
+    REQUIRE(fare[0].key == std::vector<std::string>{"ZB", "Mon"});
+    REQUIRE(fare[0].value == Catch::Approx(30.0));
+    REQUIRE(fare[1].key == std::vector<std::string>{"ZC", "Tue"});
+    auto dates = mixed.result(1);
+    REQUIRE(dates.size() == 3);
+    REQUIRE(dates[0].key == std::vector<std::string>{"2024-01-01"});
+    REQUIRE(dates[2].key == std::vector<std::string>{"2024-01-08"});
+    auto dist = mixed.result(2);
+    REQUIRE(dist.size() == 1);
+    REQUIRE(dist[0].key == std::vector<std::string>{"ZA"});
+    REQUIRE(dist[0].value == Catch::Approx(5.0));
+    REQUIRE(mixed.result(3).empty());
+    std::remove("d16.csv");
+}
+
+TEST_CASE("D17 fare and distance quantile sketches", "[D17]") {
+    QuantileSketches qs;
+    for (int v = 5; v >= 1; --v) qs.add(3, (float)v);
+    REQUIRE(qs.count(3) == 5);
+    REQUIRE(qs.quantile(3, 0.5) == 3.0);        // few values: exact
+    REQUIRE(qs.quantile(3, 0.0) == 1.0);
+    REQUIRE(qs.quantile(3, 1.0) == 5.0);
+    REQUIRE(std::isnan(qs.quantile(7, 0.5)));
+    REQUIRE(qs.count(7) == 0);
+
+    // A large stream becomes a digest: rank error around 1%, less at p99.
+    const int n = 100000;
+    QuantileSketches a, b;
+    for (int i = 0; i < n; ++i) {
+        float v = (float)((long long)i * 7919 % n);
+        a.add(0, v);
+        (i % 2 ? b : a).add(1, v);
+    }
+    REQUIRE(a.count(0) == (uint64_t)n);
+    REQUIRE(a.quantile(0, 0.5) == Catch::Approx(n * 0.5).margin(n * 0.01));
+    REQUIRE(a.quantile(0, 0.9) == Catch::Approx(n * 0.9).margin(n * 0.005));
+    REQUIRE(a.quantile(0, 0.99) == Catch::Approx(n * 0.99).margin(n * 0.002));
+    REQUIRE(a.quantile(0, 0.0) == 0.0);
+    REQUIRE(a.quantile(0, 1.0) == n - 1);
+    a.merge(1, b, 1);
+    REQUIRE(a.count(1) == (uint64_t)n);
+    REQUIRE(a.quantile(1, 0.5) == Catch::Approx(n * 0.5).margin(n * 0.01));
+    REQUIRE(a.quantile(1, 0.99) == Catch::Approx(n * 0.99).margin(n * 0.002));
+    REQUIRE(a.quantile(1, 1.0) == n - 1);
+
+    // Many small sketches share a few pool arrays.
+    QuantileSketches many;
+    for (uint32_t id = 0; id < 20000; ++id)
+        for (int j = 0; j < 3; ++j) many.add(id, (float)j);
+    long long before = g_allocations.load();
+    QuantileSketches grown;
+    for (uint32_t id = 0; id < 20000; ++id) grown.add(id, 1.0f);
+    REQUIRE(g_allocations.load() - before < 100);
+    REQUIRE(many.quantile(19999, 0.5) == 1.0);
+
+    // Per zone and per (zone, hour) through the analyzer, one and two threads.
+    std::vector<std::string> rows1 = {HDR}, rows2 = {HDR};
+    for (int i = 1; i <= 100; ++i) {
+        std::string hour = i <= 50 ? "08" : "17";
+        std::string row = std::to_string(i) + ",ZA,ZB,2024-01-01 " + hour + ":00," +
+                          std::to_string(i / 10.0) + "," + std::to_string(i);
+        (i % 2 ? rows1 : rows2).push_back(row);
+    }
+    rows1.push_back("900,ZB,ZA,2024-01-01 09:00,1.0,abc");   // counted, no fare
+    writeFile("d17a.csv", rows1);
+    writeFile("d17b.csv", rows2);
+    for (int threads : {1, 2}) {
+        TripAnalyzer ta;
+        ta.setQuantiles(true);
+        ta.setThreads(threads);
+        ta.ingestFiles({"d17a.csv", "d17b.csv"});
+        REQUIRE(ta.stats().rowsAccepted == 101);
+        auto fare = ta.zoneFareQuantiles("ZA", {0.0, 0.5, 0.9, 1.0});
+        REQUIRE(fare.size() == 4);
+        REQUIRE(fare[0] == 1.0);
+        REQUIRE(fare[1] == Catch::Approx(50.5).margin(1.0));
+        REQUIRE(fare[2] == Catch::Approx(90.1).margin(1.5));
+        REQUIRE(fare[3] == 100.0);
+        auto evening = ta.zoneQuantiles("ZA", TripValue::Fare, {0.0, 1.0}, 17);
+        REQUIRE(evening == std::vector<double>{51.0, 100.0});
+        auto dist = ta.zoneQuantiles("ZA", TripValue::Distance, {1.0});
+        REQUIRE(dist[0] == Catch::Approx(10.0));
+        REQUIRE(ta.zoneFareQuantiles("ZB", {0.5}).empty());
+        REQUIRE(ta.zoneQuantiles("ZB", TripValue::Distance, {0.5}) == std::vector<double>{1.0});
+        REQUIRE(ta.zoneFareQuantiles("ZQ", {0.5}).empty());
+        REQUIRE(ta.zoneQuantiles("ZA", TripValue::Fare, {0.5}, 3).empty());
+        REQUIRE(ta.topZones(1)[0].count == 100);
+    }
+    TripAnalyzer off;
+    off.ingestFile("d17a.csv");
+    REQUIRE(off.zoneFareQuantiles("ZA", {0.5}).empty());
+    std::remove("d17a.csv");
+    std::remove("d17b.csv");
+}
+
+TEST_CASE("D18 RFC 4180 quoted fields", "[D18]") {
+    // Quote-mask kernels against the scalar state machine: quotes land at
+    // every block offset, including runs that carry across blocks.
+    const ScanKernels* scalar = kernelsByName("scalar");
+    std::vector<char> page(3 * 4096 + 4096);
+    char* base = page.data() + (4096 - ((uintptr_t)page.data() & 4095));
+    for (size_t i = 0; i < 3 * 4096; ++i) base[i] = "a,\"b,,\"\"c,,,1\",x"[(i * 5 + i / 11) % 16];
+    for (const char* name : {"scalar", "sse42", "avx2", "avx512"}) {
+        const ScanKernels* k = kernelsByName(name);
+        if (!k) continue;
+        for (size_t len = 0; len <= 200; ++len) {
+            for (size_t start : {size_t(0), size_t(3), size_t(31), size_t(4096 - len)}) {
+                const char* b = base + start;
+                uint32_t want[16], got[16];
+                int nw = 0;
+                bool quoted = false;
+                for (size_t i = 0; i < len && nw < 16; ++i) {
+                    if (b[i] == '"') quoted = !quoted;
+                    else if (b[i] == ',' && !quoted) want[nw++] = (uint32_t)i;
+                }
+                int ng = k->findCommas(b, b + len, got, 16);
+                REQUIRE(ng == nw);
+                for (int i = 0; i < nw; ++i) REQUIRE(got[i] == want[i]);
+            }
+        }
+    }
+    REQUIRE(scalar->findCommas("\"a,b\",c", "\"a,b\",c" + 7, nullptr, 0) == 0);
+
+    std::string scratch;
+    REQUIRE(unquoteField("plain", scratch) == "plain");
+    REQUIRE(unquoteField("\"a,b\"", scratch) == "a,b");
+    REQUIRE(unquoteField("\"say \"\"hi\"\"\"", scratch) == "say \"hi\"");
+    REQUIRE(unquoteField("\"\"", scratch) == "");
+    REQUIRE(unquoteField("\"", scratch) == "\"");
+
+    // A quoted zone with commas counts under its own name, and rows that
+    // never close a quote are malformed like any short row.
+    std::vector<std::string> rows = {
+        HDR,
+        "1,\"Downtown, North\",ZX,2024-01-01 09:15,1.0,10.0",
+        "2,\"Downtown, North\",\"Z, Y\",\"2024-01-01 09:45\",\"2.5\",\"12.0\"",
+        "3,Downtown,ZX,2024-01-01 10:00,1.0,3.0",
+        "\"4\",\"The \"\"Loop\"\"\",ZX,2024-01-01 11:00,1.0,3.0",
+        "5,\"Open, ZX,2024-01-01 11:00,1.0,3.0",
+        "6,,ZX,2024-01-01 11:00,1.0,3.0",
+    };
+    for (int i = 0; i < 40; ++i)   // more escaped zones than one batch holds
+        rows.push_back(std::to_string(100 + i) + ",\"Q\"\"" + std::to_string(i % 3) + "\",ZX,2024-01-01 12:00,1,1");
+    writeFile("d18.csv", rows);
+    for (ReadMode mode : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        TripAnalyzer ta;
+        ta.setReadMode(mode);
+        ta.setQuantiles(true);
+        ta.ingestFile("d18.csv");
+        REQUIRE(ta.stats().rowsAccepted == 44);
+        REQUIRE(ta.stats().rowsMalformed == 2);
+        auto topZ = ta.topZones(10);
+        REQUIRE(hasZone(topZ, "Downtown, North", 2));
+        REQUIRE(hasZone(topZ, "Downtown", 1));
+        REQUIRE(hasZone(topZ, "The \"Loop\"", 1));
+        REQUIRE(hasZone(topZ, "Q\"0", 14));
+        REQUIRE(hasZone(topZ, "Q\"2", 13));
+        REQUIRE(hasSlot(ta.topBusySlots(10), "Downtown, North", 9, 2));
+        REQUIRE(ta.zoneFareQuantiles("Downtown, North", {1.0}) == std::vector<double>{12.0});
+    }
+
+    WindowAnalyzer window(24 * 60);
+    window.ingestFile("d18.csv");
+    REQUIRE(window.topZones(1)[0].zone == "Q\"0");
+    REQUIRE(hasZone(window.topZones(10), "Downtown, North", 2));
+
+    QueryPlan plan;
+    AggregateSpec spec;
+    REQUIRE(parseAggregateSpec("dropoff:distance", spec));
+    plan.add(spec);
+    plan.ingestFile("d18.csv");
+    REQUIRE(plan.rowsAccepted() == 44);
+    auto drop = plan.result(0);
+    REQUIRE(std::find_if(drop.begin(), drop.end(), [](const AggregateRow& r) {
+        return r.key[0] == "Z, Y" && r.value == 2.5;
+    }) != drop.end());
+
+    // CSV export quotes the names that need it, so splitting it with the
+    // same rules gives back each name in one field.
+    TripAnalyzer exported;
+    exported.ingestFile("d18.csv");
+    OutputBuffer csv;
+    formatZones(csv, exported.topZones(100), OutputFormat::Csv);
+    formatSlots(csv, exported.topBusySlots(100), OutputFormat::Csv);
+    formatAggregate(csv, "dropoff:distance", 1, drop, OutputFormat::Csv);
+    std::map<std::string, int> fieldsOf;
+    std::string text(csv.view());
+    for (size_t at = 0, nl; (nl = text.find('\n', at)) != std::string::npos; at = nl + 1) {
+        std::string line = text.substr(at, nl - at);
+        if (line[0] == '#' || line.rfind("zone,", 0) == 0) continue;
+        uint32_t commas[8];
+        int n = scalar->findCommas(line.data(), line.data() + line.size(), commas, 8);
+        fieldsOf[std::string(unquoteField(std::string_view(line.data(), commas[0]), scratch))] = n + 1;
+    }
+    REQUIRE(fieldsOf["Downtown, North"] == 3);
+    REQUIRE(fieldsOf["The \"Loop\""] == 3);
+    REQUIRE(fieldsOf["Downtown"] == 3);         // the last slot row of a zone wins
+    REQUIRE(fieldsOf["Z, Y"] == 2);
+
+    // Values that are not whole numbers in range print in fixed notation.
+    OutputBuffer odd;
+    formatAggregate(odd, "x", 1, {{{"nan"}, std::nan("")}, {{"big"}, 1e19}, {{"whole"}, -3.0}}, OutputFormat::Csv);
+    REQUIRE(odd.view() == "# x\nnan,nan\nbig,10000000000000000000.00\nwhole,-3\n");
+    std::remove("d18.csv");
+}
+
+TEST_CASE("D19 header-driven column mapping", "[D19]") {
+    ColumnMap std1 = ColumnMap::fromHeader(HDR);
+    REQUIRE(std1.standard);
+    REQUIRE(ColumnMap::fromHeader("tripid,pickupzoneid,dropoffzoneid,pickupdatetime,distancekm,fareamount\r").standard);
+    REQUIRE(ColumnMap::fromHeader("1000001,ZONE254,ZONE819,2024-01-01 00:00,16.0,74.9").standard);
+    ColumnMap moved = ColumnMap::fromHeader("Vendor,\"PickupDateTime\",PickupZoneID,TripID");
+    REQUIRE_FALSE(moved.standard);
+    REQUIRE(moved.index[ColumnMap::kTime] == 1);
+    REQUIRE(moved.index[ColumnMap::kPickup] == 2);
+    REQUIRE(moved.index[ColumnMap::kFare] == -1);
+    REQUIRE(moved.commasFor(ColumnMap::bit(ColumnMap::kPickup) | ColumnMap::bit(ColumnMap::kTime)) == 2);
+
+    // The same trips in the standard layout and in a 34-column layout
+    // with the wanted columns reordered and far to the right.
+    std::vector<std::string> plain = {HDR}, wide;
+    std::string header;
+    for (int c = 0; c < 28; ++c) header += "extra" + std::to_string(c) + ",";
+    header += "FareAmount,PickupDateTime,DropoffZoneID,TripID,DistanceKm,PickupZoneID";
+    wide.push_back(header);
+    for (int i = 0; i < 500; ++i) {
+        std::string trip = std::to_string(i % 450), zone = "Z" + std::to_string(i * 7 % 23);
+        std::string drop = "D" + std::to_string(i % 5), hour = (i % 24 < 10 ? "0" : "") + std::to_string(i % 24);
+        std::string ts = "2024-01-0" + std::to_string(1 + i % 7) + " " + hour + ":30";
+        std::string dist = std::to_string(1 + i % 9), fare = std::to_string(5 + i % 40);
+        plain.push_back(trip + "," + zone + "," + drop + "," + ts + "," + dist + "," + fare);
+        std::string row;
+        for (int c = 0; c < 28; ++c) row += "x,";
+        wide.push_back(row + fare + "," + ts + "," + drop + "," + trip + "," + dist + "," + zone);
+    }
+    wide.push_back("short,row");                           // malformed in both
+    plain.push_back("short,row");
+    wide.push_back(std::string(28, ',') + "1,2024-01-01 25:00,D,1,1,Z1");   // bad hour
+    plain.push_back("1,Z1,D,2024-01-01 25:00,1,1");
+    writeFile("d19p.csv", plain);
+    writeFile("d19w.csv", wide);
+    writeFile("d19w2.csv", wide);
+
+    TripAnalyzer ref;
+    ref.setQuantiles(true);
+    ref.ingestFile("d19p.csv");
+    REQUIRE(ref.stats().rowsAccepted == 500);
+    for (ReadMode mode : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        for (int threads : {1, 3}) {
+            TripAnalyzer ta;
+            ta.setReadMode(mode);
+            ta.setThreads(threads);
+            ta.setQuantiles(true);
+            ta.ingestFile("d19w.csv");
+            REQUIRE(ta.stats().rowsAccepted == 500);
+            REQUIRE(ta.stats().rowsMalformed == 2);
+            REQUIRE(ta.topZones(50).size() == ref.topZones(50).size());
+            for (size_t i = 0; i < ref.topZones(50).size(); ++i) {
+                REQUIRE(ta.topZones(50)[i].zone == ref.topZones(50)[i].zone);
+                REQUIRE(ta.topZones(50)[i].count == ref.topZones(50)[i].count);
+            }
+            auto a = ta.topBusySlots(1000), b = ref.topBusySlots(1000);
+            REQUIRE(a.size() == b.size());
+            for (size_t i = 0; i < a.size(); ++i) REQUIRE((a[i].zone == b[i].zone && a[i].hour == b[i].hour));
+            REQUIRE(ta.zoneFareQuantiles("Z3", {0.5}) == ref.zoneFareQuantiles("Z3", {0.5}));
+        }
+    }
+
+    // Mixed layouts in one ingest; each file is read by its own header.
+    TripAnalyzer mixed;
+    mixed.setDedup(true);
+    mixed.ingestFiles({"d19p.csv", "d19w.csv"});
+    REQUIRE(mixed.stats().duplicatesRejected == 500 + 50);
+    REQUIRE(mixed.stats().rowsAccepted == 450);
+    TripAnalyzer both;
+    both.setThreads(2);
+    both.ingestFiles({"d19p.csv", "d19w.csv", "d19w2.csv"});
+    REQUIRE(both.topZones(1)[0].count == 3 * ref.topZones(1)[0].count);
+
+    WindowAnalyzer wa(7 * 24 * 60), wp(7 * 24 * 60);
+    wa.ingestFile("d19w.csv");
+    wp.ingestFile("d19p.csv");
+    REQUIRE(wa.rowsInWindow() == wp.rowsInWindow());
+    REQUIRE(wa.topZones(3)[0].zone == wp.topZones(3)[0].zone);
+
+    AggregateSpec spec;
+    REQUIRE(parseAggregateSpec("dropoff,weekday:fare", spec));
+    QueryPlan pw, pp;
+    pw.add(spec);
+    pp.add(spec);
+    pw.ingestFile("d19w.csv");
+    pp.ingestFile("d19p.csv");
+    REQUIRE(pw.rowsAccepted() == 500);
+    auto rw = pw.result(0), rp = pp.result(0);
+    REQUIRE(rw.size() == rp.size());
+    for (size_t i = 0; i < rw.size(); ++i) {
+        REQUIRE(rw[i].key == rp[i].key);
+        REQUIRE(rw[i].value == rp[i].value);
+    }
+    std::remove("d19p.csv");
+    std::remove("d19w.csv");
+    std::remove("d19w2.csv");
+}
+
+TEST_CASE("D20 quarantine of rejected rows", "[D20]") {
+    const std::string body[] = {
+        "1,ZONE_A,ZX,2024-01-01 09:15,1,1",
+        "2,,ZX,2024-01-01 09:15,1,1",
+        "3,ZONE_A,ZX,,1,1",
+        "4,ZONE_A,ZX,2024-01-01 10:00",
+        "5,ZONE_B,ZY,NOT_A_DATE,2,1",
+        "1,ZONE_B,ZY,2024-01-01 23:59,2,1",
+        "6,ZONE_B,ZY,2024-01-01 24:00,2,\"a,b\"",
+    };
+    std::vector<std::string> lines = {HDR};
+    for (const auto& row : body) lines.push_back(row);
+    writeFile("d20.csv", lines);
+    long long offsets[7];
+    long long at = std::string(HDR).size() + 1;
+    for (int i = 0; i < 7; ++i) {
+        offsets[i] = at;
+        at += body[i].size() + 1;
+    }
+
+    auto readLines = [](const std::string& path) {
+        std::ifstream in(path);
+        std::vector<std::string> out;
+        for (std::string l; std::getline(in, l);) out.push_back(l);
+        return out;
+    };
+    auto expected = [&](const char* reason, int i) {
+        std::string row;
+        for (char c : body[i]) row += c == '"' ? std::string("\"\"") : std::string(1, c);
+        return std::string(reason) + ",\"d20.csv\"," + std::to_string(offsets[i]) + ",\"" + row + "\"";
+    };
+
+    for (ReadMode mode : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        TripAnalyzer ta;
+        ta.setReadMode(mode);
+        ta.setDedup(true);
+        REQUIRE(ta.setQuarantine("d20q.csv"));
+        ta.ingestFile("d20.csv");
+        REQUIRE(ta.stats().rowsAccepted == 1);
+        REQUIRE(ta.stats().rowsQuarantined == 6);
+        auto q = readLines("d20q.csv");
+        REQUIRE(q.size() == 7);
+        REQUIRE(q[0] == "reason,file,offset,row");
+        // Duplicates are found after their batch is parsed, so the order
+        // of reasons can differ by reader; the offsets identify the rows.
+        std::vector<std::string> got(q.begin() + 1, q.end()), want = {
+            expected("empty_zone", 1), expected("bad_time", 2), expected("columns", 3),
+            expected("bad_time", 4), expected("duplicate", 5), expected("bad_time", 6)};
+        std::sort(got.begin(), got.end());
+        std::sort(want.begin(), want.end());
+        REQUIRE(got == want);
+        // Counting is unaffected by the quarantine.
+        REQUIRE(hasZone(ta.topZones(10), "ZONE_A", 1));
+    }
+
+    // Sampling and cap bound the side file; threads share one sink.
+    TripAnalyzer sampled;
+    REQUIRE(sampled.setQuarantine("d20q.csv", 2, 2));
+    sampled.setThreads(2);
+    sampled.ingestFiles({"d20.csv", "d20.csv", "d20.csv"});
+    REQUIRE(sampled.stats().rowsMalformed == 15);
+    REQUIRE(sampled.stats().rowsQuarantined == 2);
+    REQUIRE(sampled.quarantine()->rejected() == 15);
+    REQUIRE(readLines("d20q.csv").size() == 3);
+
+    REQUIRE_FALSE(TripAnalyzer().setQuarantine("no_such_dir/q.csv"));
+    std::remove("d20.csv");
+    std::remove("d20q.csv");
+}
+
+TEST_CASE("D21 strict timestamp validation", "[D21]") {
+    CivilTime t;
+    REQUIRE(parseCivilTime("2024-02-29 23:59", t));
+    REQUIRE(t.year == 2024);
+    REQUIRE(t.month == 2);
+    REQUIRE(t.day == 29);
+    REQUIRE(t.hour == 23);
+    REQUIRE(t.minute == 59);
+    for (const char* bad : {"2024/01/01 09:15", "2024-01-01T09:15", "2024-01-01 09.15", "2O24-01-01 09:15",
+                            "2024-13-01 09:15", "2024-00-01 09:15", "2024-01-00 09:15", "2024-01-32 09:15",
+                            "2024-01-01 24:00", "2024-01-01 09:60", "2024-01-01 9X:00", "2024-01-01 :9:00",
+                            "NOT_A_DATE 12:30", "2024-02-30 09:15", "2023-02-29 09:15", "1900-02-29 09:15",
+                            "2024-04-31 09:15", "2024-06-31 09:15", "2024-09-31 09:15", "2024-11-31 09:15"})
+        REQUIRE_FALSE(parseCivilTime(bad, t));
+    for (const char* good : {"2000-02-29 00:00", "2023-02-28 00:00", "2024-01-31 00:00", "2024-03-31 00:00",
+                             "2024-04-30 00:00", "2024-07-31 00:00", "2024-08-31 00:00", "2024-12-31 00:00"})
+        REQUIRE(parseCivilTime(good, t));
+    REQUIRE(validTimestamp("2024-01-01 09:15:59", t));
+    REQUIRE_FALSE(validTimestamp("2024-01-01 09:15:60", t));
+    REQUIRE_FALSE(validTimestamp("2024-01-01 09:15 ", t));
+    REQUIRE(parseEpochMinute("1970-01-02 00:01") == 1441);
+    REQUIRE(parseEpochMinute("1970-01-01 24:00") == -1);
+
+    writeFile("d21.csv", {HDR,
+        "1,ZONE_A,ZX,2024-01-01 09:15,1,1",
+        "2,ZONE_A,ZX,2024-01-01 09:15:30,1,1",
+        "3,ZONE_A,ZX,NOT_A_DATE 12:30,1,1",
+        "4,ZONE_A,ZX,2024-19-01 12:30,1,1",
+        "5,ZONE_A,ZX,2024-01-01 12:30junk,1,1",
+        "6,ZONE_A,ZX,\"2024-01-01 12:30\",1,1"});
+    for (ReadMode mode : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        TripAnalyzer lenient;
+        lenient.setReadMode(mode);
+        lenient.ingestFile("d21.csv");
+        REQUIRE(lenient.stats().rowsAccepted == 6);
+
+        TripAnalyzer strict;
+        strict.setReadMode(mode);
+        strict.setStrictTimestamps(true);
+        strict.setThreads(2);
+        strict.ingestFile("d21.csv");
+        REQUIRE(strict.stats().rowsAccepted == 3);
+        REQUIRE(strict.stats().rowsMalformed == 3);
+        auto slots = strict.topBusySlots(10);
+        REQUIRE(slots.size() == 2);
+        REQUIRE(slots[0].hour == 9);
+        REQUIRE(slots[0].count == 2);
+        REQUIRE(slots[1].hour == 12);
+    }
+    std::remove("d21.csv");
+}
+
+TEST_CASE("D22 checkpointed ingest resumes where it stopped", "[D22]") {
+    auto rows = [](int salt) {
+        std::vector<std::string> a = {HDR}, b = {HDR};
+        for (int i = 0; i < 3000; ++i) {
+            int h = (i + salt) % 24;
+            std::string row = std::to_string(i) + ",Z" + std::to_string((i * 7 + salt) % 40) + ",ZX,2024-01-0" +
+                              std::to_string(1 + i % 9) + (h < 10 ? " 0" : " ") + std::to_string(h) + ":15,1,1";
+            (i % 3 ? a : b).push_back(row);
+        }
+        a.push_back("bad,row");
+        return std::make_pair(a, b);
+    };
+    auto files = rows(0);
+    writeFile("d22a.csv", files.first);
+    writeFile("d22b.csv", files.second);
+    const std::vector<std::string> inputs = {"d22a.csv", "d22b.csv"};
+    std::remove("d22.ckpt");
+
+    auto same = [](const TripAnalyzer& ta, const TripAnalyzer& ref) {
+        auto z = ta.topZones(100), rz = ref.topZones(100);
+        REQUIRE(z.size() == rz.size());
+        for (size_t i = 0; i < z.size(); ++i) REQUIRE((z[i].zone == rz[i].zone && z[i].count == rz[i].count));
+        auto s = ta.topBusySlots(2000), rs = ref.topBusySlots(2000);
+        REQUIRE(s.size() == rs.size());
+        for (size_t i = 0; i < s.size(); ++i)
+            REQUIRE((s[i].zone == rs[i].zone && s[i].hour == rs[i].hour && s[i].count == rs[i].count));
+        REQUIRE(ta.stats().rowsRead == ref.stats().rowsRead);
+        REQUIRE(ta.stats().rowsAccepted == ref.stats().rowsAccepted);
+        REQUIRE(ta.stats().rowsMalformed == ref.stats().rowsMalformed);
+        REQUIRE(ta.stats().filesRead == ref.stats().filesRead);
+        REQUIRE(ta.stats().bytesRead == ref.stats().bytesRead);
+    };
+    TripAnalyzer ref;
+    ref.ingestFiles(inputs);
+    REQUIRE(ref.stats().rowsMalformed == 1);
+
+    for (ReadMode mode : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        // Every run stops at its first checkpoint; the next picks up there.
+        int runs = 0;
+        long long resumed = 0;
+        for (;;) {
+            TripAnalyzer ta;
+            ta.setReadMode(mode);
+            ta.setThreads(3);
+            ta.setCheckpoint("d22.ckpt", 8192);
+            ta.stopIngest();
+            ta.ingestFiles(inputs);
+            REQUIRE(++runs < 100);
+            if (runs > 1) REQUIRE(ta.stats().resumedBytes > resumed);
+            resumed = ta.stats().resumedBytes;
+            if (!ta.stats().stopped) {
+                same(ta, ref);
+                break;
+            }
+            REQUIRE(ta.stats().checkpointsWritten == 1);
+            REQUIRE(std::ifstream("d22.ckpt").good());
+        }
+        REQUIRE(runs >= (mode == ReadMode::Stream ? 3 : 10));
+        REQUIRE_FALSE(std::ifstream("d22.ckpt").good());
+        REQUIRE_FALSE(std::ifstream("d22.ckpt.state1").good());
+    }
+
+    // Uninterrupted, checkpoints are written along the way and removed.
+    TripAnalyzer whole;
+    whole.setCheckpoint("d22.ckpt", 8192);
+    whole.ingestFiles(inputs);
+    REQUIRE(whole.stats().checkpointsWritten > 0);
+    REQUIRE(whole.stats().resumedBytes == 0);
+    same(whole, ref);
+    REQUIRE_FALSE(std::ifstream("d22.ckpt").good());
+
+    // A file rewritten since the checkpoint is read again from the start.
+    TripAnalyzer stopped;
+    stopped.setCheckpoint("d22.ckpt", 8192);
+    stopped.stopIngest();
+    stopped.ingestFiles(inputs);
+    REQUIRE(stopped.stats().stopped);
+    files = rows(5);
+    writeFile("d22a.csv", files.first);
+    TripAnalyzer changedRef, changed;
+    changedRef.ingestFiles(inputs);
+    changed.setCheckpoint("d22.ckpt", 8192);
+    changed.ingestFiles(inputs);
+    REQUIRE(changed.stats().resumedBytes == 0);
+    same(changed, changedRef);
+
+    // Dedup state is not checkpointed, so dedup ingest does not checkpoint.
+    TripAnalyzer dedup;
+    dedup.setDedup(true);
+    dedup.setCheckpoint("d22.ckpt", 8192);
+    REQUIRE_FALSE(dedup.checkpointing());
+    TripAnalyzer approx;
+    approx.setMode(IngestMode::Sketch);
+    approx.setCheckpoint("d22.ckpt", 8192);
+    REQUIRE_FALSE(approx.checkpointing());
+    approx.setMode(IngestMode::Exact);
+    REQUIRE(approx.checkpointing());
+    approx.setMemoryBudget(1 << 20, ".");
+    REQUIRE_FALSE(approx.checkpointing());
+    dedup.stopIngest();
+    dedup.ingestFiles(inputs);
+    REQUIRE_FALSE(dedup.stats().stopped);
+    REQUIRE(dedup.stats().checkpointsWritten == 0);
+    REQUIRE_FALSE(std::ifstream("d22.ckpt").good());
+
+    // The fingerprint covers the whole prefix, not just its ends.
+    std::vector<std::string> big = {HDR};
+    for (int i = 0; i < 120000; ++i)
+        big.push_back(std::to_string(i) + ",Z" + std::to_string(i % 50) + ",ZX,2024-01-01 09:15,1,1");
+    writeFile("d22a.csv", big);
+    uint64_t before = 0, after = 0;
+    REQUIRE(fingerprintFile("d22a.csv", 3000000, before));
+    big[60000].replace(big[60000].find(",Z"), 2, ",Y");
+    writeFile("d22a.csv", big);
+    REQUIRE(fingerprintFile("d22a.csv", 3000000, after));
+    REQUIRE(before != after);
+    REQUIRE_FALSE(fingerprintFile("d22a.csv", 1ull << 30, after));
+
+    // Offsets stop at end of file when the last row has no newline.
+    const std::string unterminated = std::string(HDR) + "\n1,Z1,ZX,2024-01-01 09:15,1,1\n2,Z2,ZX,2024-01-01 10:15,1,1";
+    {
+        std::ofstream out("d22a.csv", std::ios::binary);
+        out << unterminated;
+    }
+    for (ReadMode mode : {ReadMode::Getline, ReadMode::Mmap, ReadMode::Stream}) {
+        TripAnalyzer ta;
+        ta.setReadMode(mode);
+        ta.ingestFile("d22a.csv");
+        REQUIRE(ta.stats().rowsAccepted == 2);
+        REQUIRE(ta.stats().bytesRead == (long long)unterminated.size());
+    }
+    std::remove("d22a.csv");
+    std::remove("d22b.csv");
+}
+
+TEST_CASE("D23 async block reader", "[D23]") {
+    std::string bytes;
+    for (int i = 0; bytes.size() < 300000; ++i) bytes += std::to_string(i * 7919) + (i % 13 ? "," : "\n");
+    {
+        std::ofstream out("d23.bin", std::ios::binary);
+        out << bytes;
+    }
+    using Backend = AsyncFileReader::Backend;
+    for (Backend backend : {Backend::IoUring, Backend::Threads}) {
+        for (int depth : {1, 3}) {
+            for (size_t start : {size_t(0), size_t(12345), bytes.size()}) {
+                AsyncFileReader reader;
+                if (!reader.open("d23.bin", start, 64 << 10, depth, backend)) {
+                    REQUIRE(backend == Backend::IoUring);   // kernel without io_uring
+                    continue;
+                }
+                REQUIRE(reader.backend() == backend);
+                std::string got;
+                const char* data;
+                size_t size;
+                while (reader.next(data, size) && size > 0) {
+                    REQUIRE(reader.offset() == start + got.size());
+                    got.append(data, size);
+                }
+                REQUIRE(got == bytes.substr(start));
+            }
+        }
+    }
+    AsyncFileReader missing;
+    REQUIRE_FALSE(missing.open("no_such_file_d23.bin"));
+    std::remove("d23.bin");
+
+    // Small blocks cut many rows in two; results match the getline reader.
+    std::vector<std::string> lines = {HDR};
+    for (int i = 0; i < 4000; ++i) {
+        int h = i % 24;
+        lines.push_back(std::to_string(i) + ",\"Z" + std::to_string(i * 11 % 57) + "\",ZX,2024-03-0" +
+                        std::to_string(1 + i % 9) + (h < 10 ? " 0" : " ") + std::to_string(h) + ":30,1.5,9");
+        if (i % 500 == 0) lines.push_back("broken row " + std::to_string(i));
+    }
+    writeFile("d23a.csv", lines);
+    writeFile("d23b.csv", {HDR, "x,Z1,ZX,2024-03-01 05:00,1,1", "y,Z2,ZX,2024-03-01 06:00,1,1"});
+    const std::vector<std::string> inputs = {"d23a.csv", "d23b.csv"};
+    TripAnalyzer ref;
+    REQUIRE(ref.setQuarantine("d23ref.csv"));
+    ref.ingestFiles(inputs);
+    auto readAll = [](const std::string& path) {
+        std::ifstream in(path);
+        std::vector<std::string> out;
+        for (std::string l; std::getline(in, l);) out.push_back(l);
+        std::sort(out.begin(), out.end());
+        return out;
+    };
+    for (Backend backend : {Backend::Auto, Backend::Threads}) {
+        for (int threads : {1, 2}) {
+            TripAnalyzer ta;
+            ta.setReadMode(ReadMode::Async);
+            ta.setAsyncReads(3, 4096, backend);
+            ta.setThreads(threads);
+            REQUIRE(ta.setQuarantine("d23q.csv"));
+            ta.ingestFiles(inputs);
+            REQUIRE(ta.stats().rowsAccepted == ref.stats().rowsAccepted);
+            REQUIRE(ta.stats().rowsMalformed == 8);
+            REQUIRE(ta.stats().bytesRead == ref.stats().bytesRead);
+            REQUIRE(ta.stats().filesRead == 2);
+            auto z = ta.topZones(100), rz = ref.topZones(100);
+            REQUIRE(z.size() == rz.size());
+            for (size_t i = 0; i < z.size(); ++i) REQUIRE((z[i].zone == rz[i].zone && z[i].count == rz[i].count));
+            auto s = ta.topBusySlots(2000), rs = ref.topBusySlots(2000);
+            REQUIRE(s.size() == rs.size());
+            for (size_t i = 0; i < s.size(); ++i)
+                REQUIRE((s[i].zone == rs[i].zone && s[i].hour == rs[i].hour && s[i].count == rs[i].count));
+            ta = TripAnalyzer();    // flushes the quarantine
+            REQUIRE(readAll("d23q.csv") == readAll("d23ref.csv"));
+        }
+    }
+
+    // Checkpoints fall on block boundaries and resume mid-file.
+    std::remove("d23.ckpt");
+    int runs = 0;
+    for (;;) {
+        TripAnalyzer ta;
+        ta.setReadMode(ReadMode::Async);
+        ta.setAsyncReads(2, 8192);
+        ta.setCheckpoint("d23.ckpt", 16384);
+        ta.stopIngest();
+        ta.ingestFiles(inputs);
+        REQUIRE(++runs < 100);
+        if (ta.stats().stopped) continue;
+        REQUIRE(ta.stats().rowsAccepted == ref.stats().rowsAccepted);
+        REQUIRE(ta.stats().bytesRead == ref.stats().bytesRead);
+        REQUIRE(ta.topZones(100).size() == ref.topZones(100).size());
+        for (size_t i = 0; i < ref.topZones(100).size(); ++i)
+            REQUIRE(ta.topZones(100)[i].count == ref.topZones(100)[i].count);
+        break;
+    }
+    REQUIRE(runs > 3);
+
+    // A read that fails does not count the file as read.
+    TripAnalyzer unreadable;
+    unreadable.setReadMode(ReadMode::Async);
+    unreadable.ingestFile(".");
+    REQUIRE(unreadable.stats().filesRead == 0);
+    for (const char* f : {"d23a.csv", "d23b.csv", "d23q.csv", "d23ref.csv"}) std::remove(f);
+}
@@ -0,0 +1,157 @@
+#include "window.h"
+#include "kernels.h"
+#include "civiltime.h"
+#include <algorithm>
+#include <fstream>
+using namespace std;
+
+WindowAnalyzer::WindowAnalyzer(int windowMinutes)
+    : ring(max(windowMinutes, 1)), zoneRanking(ZoneRank{&zones}), slotRanking(SlotRank{&zones}) {}
+
+long long WindowAnalyzer::parseMinute(std::string_view ts) {
+    return parseEpochMinute(ts);
+}
+
+bool WindowAnalyzer::ingestLine(std::string_view line) {
+    RowFields& f = fields;
+    int commas = columns.commasFor(ColumnMap::bit(ColumnMap::kPickup) | ColumnMap::bit(ColumnMap::kTime));
+    if (!f.split(line.data(), line.data() + line.size(), commas)) {
+        ++malformed;
+        return false;
+    }
+    string scratch, tsScratch;
+    string_view zone = unquoteField(f[columns.index[ColumnMap::kPickup]], scratch);
+    long long minute = parseMinute(unquoteField(f[columns.index[ColumnMap::kTime]], tsScratch));
+    if (zone.empty() || minute < 0) {
+        ++malformed;
+        return false;
+    }
+    return add(zone, minute);
+}
+
+void WindowAnalyzer::setHeader(std::string_view header) {
+    columns = ColumnMap::fromHeader(header);
+}
+
+bool WindowAnalyzer::ingestFile(const string& csvPath) {
+    ifstream file(csvPath);
+    if (!file) return false;
+    string line;
+    getline(file, line);
+    setHeader(line);
+    while (getline(file, line)) ingestLine(line);
+    return true;
+}
+
+bool WindowAnalyzer::add(std::string_view zone, long long minute) {
+    long long n = (long long)ring.size();
+    if (newest >= 0 && minute <= newest - n) {
+        ++late;
+        return false;
+    }
+    if (minute > newest) advanceTo(minute);
+
+    uint32_t z = zones.findOrInsert(zone);
+    if (z == zoneCounts.size()) {
+        zoneCounts.push_back(0);
+        zoneRanked.push_back(0);
+        zoneDirty.push_back(0);
+        slotCounts.resize(slotCounts.size() + 24, 0);
+        slotRanked.resize(slotCounts.size(), 0);
+        slotDirty.resize(slotCounts.size(), 0);
+        entryMinute.resize(slotCounts.size(), -1);
+        entryIndex.resize(slotCounts.size(), 0);
+    }
+    uint32_t slot = z * 24 + (uint32_t)(minute / 60 % 24);
+    vector<BucketEntry>& bucket = ring[minute % n];
+    if (entryMinute[slot] == minute) {
+        ++bucket[entryIndex[slot]].count;
+    } else {
+        entryMinute[slot] = minute;
+        entryIndex[slot] = (uint32_t)bucket.size();
+        bucket.push_back({slot, 1});
+    }
+    count(slot, +1);
+    ++live;
+    return true;
+}
+
+// Expires the minutes that leave the window when "now" moves to minute.
+// A jump of a whole window or more empties every bucket once.
+void WindowAnalyzer::advanceTo(long long minute) {
+    long long n = (long long)ring.size();
+    if (newest >= 0) {
+        long long steps = min(minute - newest, n);
+        for (long long m = newest + 1; m < newest + 1 + steps; ++m) {
+            vector<BucketEntry>& bucket = ring[m % n];
+            for (const BucketEntry& e : bucket) {
+                count(e.slot, -(long long)e.count);
+                live -= e.count;
+            }
+            bucket.clear();
+        }
+    }
+    newest = minute;
+}
+
+void WindowAnalyzer::count(uint32_t slot, long long delta) {
+    uint32_t z = slot / 24;
+    zoneCounts[z] += delta;
+    slotCounts[slot] += delta;
+    if (!zoneDirty[z]) {
+        zoneDirty[z] = 1;
+        dirtyZones.push_back(z);
+    }
+    if (!slotDirty[slot]) {
+        slotDirty[slot] = 1;
+        dirtySlots.push_back(slot);
+    }
+}
+
+// Moves key to count in ranking, reusing its node; a count of 0 drops it.
+template <class Ranking, class Key>
+static void rerank(Ranking& ranking, Key key, long long count) {
+    if (key.count == count) return;
+    if (key.count > 0) {
+        auto node = ranking.extract(key);
+        if (count == 0) return;
+        node.value().count = count;
+        ranking.insert(std::move(node));
+    } else {
+        key.count = count;
+        ranking.insert(key);
+    }
+}
+
+// Re-ranks only the zones and slots whose count changed since the last
+// query, once each however many rows touched them.
+void WindowAnalyzer::refreshRanking() const {
+    for (uint32_t z : dirtyZones) {
+        rerank(zoneRanking, ZoneKey{zoneRanked[z], z}, zoneCounts[z]);
+        zoneRanked[z] = zoneCounts[z];
+        zoneDirty[z] = 0;
+    }
+    dirtyZones.clear();
+    for (uint32_t slot : dirtySlots) {
+        rerank(slotRanking, SlotKey{slotRanked[slot], slot}, slotCounts[slot]);
+        slotRanked[slot] = slotCounts[slot];
+        slotDirty[slot] = 0;
+    }
+    dirtySlots.clear();
+}
+
+std::vector<ZoneCount> WindowAnalyzer::topZones(int k) const {
+    refreshRanking();
+    vector<ZoneCount> result;
+    for (auto it = zoneRanking.begin(); it != zoneRanking.end() && (int)result.size() < k; ++it)
+        result.push_back({string(zones.name(it->zone)), it->count});
+    return result;
+}
+
+std::vector<SlotCount> WindowAnalyzer::topBusySlots(int k) const {
+    refreshRanking();
+    vector<SlotCount> result;
+    for (auto it = slotRanking.begin(); it != slotRanking.end() && (int)result.size() < k; ++it)
+        result.push_back({string(zones.name(it->slot / 24)), (int)(it->slot % 24), it->count});
+    return result;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "analyzer.h"
+#include "columns.h"
+#include "zonetable.h"
+using namespace std;
+
+// Streaming top-k over the last N minutes of pickup time. The newest
+// pickup minute seen is "now"; the window is (now - N, now].
+//
+// Each minute's ring bucket holds a (slot, count) entry per slot with rows
+// in that minute, so moving "now" forward subtracts a whole bucket one
+// entry at a time rather than one row at a time. Rows only touch plain
+// counters and mark what changed; the ranked sets (count desc, zone asc,
+// hour asc) are brought up to date from those marks when topZones or
+// topBusySlots asks, which then read the first k entries instead of
+// rescanning all zones.
+class WindowAnalyzer {
+public:
+    explicit WindowAnalyzer(int windowMinutes = 60);
+    WindowAnalyzer(const WindowAnalyzer&) = delete;
+    WindowAnalyzer& operator=(const WindowAnalyzer&) = delete;
+
+    // One CSV data row, in the layout of the last header given (standard
+    // until then). False if malformed or older than the window.
+    bool ingestLine(std::string_view line);
+    void setHeader(std::string_view header);
+    // Replays a CSV file in file order, columns mapped from its header.
+    bool ingestFile(const string& csvPath);
+    // minute = minutes since 1970-01-01 00:00 of the pickup time.
+    bool add(std::string_view zone, long long minute);
+
+    std::vector<ZoneCount> topZones(int k = 10) const;
+    std::vector<SlotCount> topBusySlots(int k = 10) const;
+
+    int windowMinutes() const { return (int)ring.size(); }
+    long long now() const { return newest; }        // -1 before the first row
+    long long rowsInWindow() const { return live; }
+    long long rowsLate() const { return late; }
+    long long rowsMalformed() const { return malformed; }
+
+    // "YYYY-MM-DD HH:MM" -> minutes since the epoch; -1 if not a valid time.
+    static long long parseMinute(std::string_view ts);
+
+private:
+    struct ZoneKey {
+        long long count;
+        uint32_t zone;
+    };
+    struct SlotKey {
+        long long count;
+        uint32_t slot;        // zone * 24 + hour
+    };
+    // Rank order of the output: count desc, zone asc, hour asc.
+    struct ZoneRank {
+        const ZoneTable* names;
+        bool operator()(const ZoneKey& a, const ZoneKey& b) const {
+            if (a.count != b.count) return a.count > b.count;
+            return names->name(a.zone) < names->name(b.zone);
+        }
+    };
+    struct SlotRank {
+        const ZoneTable* names;
+        bool operator()(const SlotKey& a, const SlotKey& b) const {
+            if (a.count != b.count) return a.count > b.count;
+            uint32_t za = a.slot / 24, zb = b.slot / 24;
+            if (za != zb) return names->name(za) < names->name(zb);
+            return a.slot < b.slot;
+        }
+    };
+
+    struct BucketEntry {
+        uint32_t slot;
+        uint32_t count;
+    };
+
+    void advanceTo(long long minute);
+    void count(uint32_t slot, long long delta);
+    void refreshRanking() const;
+
+    vector<vector<BucketEntry>> ring;  // minute % N -> rows per slot
+    long long newest = -1;
+    ZoneTable zones;
+    vector<long long> zoneCounts;
+    vector<long long> slotCounts;
+    // Per slot: the minute and bucket index of its newest entry, so rows of
+    // one slot and minute share an entry.
+    vector<long long> entryMinute;
+    vector<uint32_t> entryIndex;
+    // Counts as the ranked sets hold them, and what changed since.
+    mutable vector<long long> zoneRanked, slotRanked;
+    mutable vector<uint32_t> dirtyZones, dirtySlots;
+    mutable vector<char> zoneDirty, slotDirty;
+    mutable set<ZoneKey, ZoneRank> zoneRanking;
+    mutable set<SlotKey, SlotRank> slotRanking;
+    long long live = 0, late = 0, malformed = 0;
+    ColumnMap columns;
+    RowFields fields;
+};
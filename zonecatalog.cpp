@@ -0,0 +1,82 @@
+#include "zonecatalog.h"
+#include <algorithm>
+#include <fstream>
+using namespace std;
+
+bool ZoneCatalog::load(const string& path) {
+    ifstream in(path);
+    if (!in) return false;
+    vector<string> names;
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) names.push_back(line);
+    }
+    return build(std::move(names));
+}
+
+bool ZoneCatalog::build(vector<string> names) {
+    sort(names.begin(), names.end());
+    names.erase(unique(names.begin(), names.end()), names.end());
+    if (names.empty()) return false;
+
+    vector<uint64_t> hashes(names.size());
+    for (size_t i = 0; i < names.size(); ++i) hashes[i] = hashZone(names[i].data(), names[i].size());
+    for (uint64_t attempt = 0; attempt < 16; ++attempt) {
+        salt = attempt * 0xd6e8feb86659fd93ULL;
+        if (place(names, hashes)) return true;
+    }
+    seeds.clear();
+    offsets.assign(1, 0);
+    arena.clear();
+    return false;
+}
+
+// Buckets are placed largest first, each trying seeds until its keys land
+// on free, distinct positions. Fails (and the caller re-salts) if a bucket
+// exhausts the seed budget.
+bool ZoneCatalog::place(const vector<string>& names, const vector<uint64_t>& hashes) {
+    size_t n = names.size();
+    seeds.assign((n + 3) / 4, 0);
+    offsets.assign(n + 1, 0);   // size() == n while positions are searched
+
+    vector<vector<uint32_t>> members(seeds.size());
+    for (uint32_t i = 0; i < n; ++i) members[bucket(hashes[i])].push_back(i);
+    vector<uint32_t> order(seeds.size());
+    for (uint32_t b = 0; b < order.size(); ++b) order[b] = b;
+    stable_sort(order.begin(), order.end(),
+                [&](uint32_t a, uint32_t b) { return members[a].size() > members[b].size(); });
+
+    vector<uint32_t> owner(n, kNone);
+    vector<uint32_t> pos;
+    for (uint32_t b : order) {
+        const vector<uint32_t>& keys = members[b];
+        if (keys.empty()) break;
+        uint32_t seed = 0;
+        for (;; ++seed) {
+            if (seed == (1u << 24)) return false;
+            pos.clear();
+            bool ok = true;
+            for (uint32_t k : keys) {
+                uint32_t p = position(hashes[k], seed);
+                if (owner[p] != kNone || std::find(pos.begin(), pos.end(), p) != pos.end()) {
+                    ok = false;
+                    break;
+                }
+                pos.push_back(p);
+            }
+            if (ok) break;
+        }
+        seeds[b] = seed;
+        for (size_t j = 0; j < keys.size(); ++j) owner[pos[j]] = keys[j];
+    }
+
+    arena.clear();
+    offsets.assign(1, 0);
+    for (uint32_t p = 0; p < n; ++p) {
+        const string& s = names[owner[p]];
+        arena.insert(arena.end(), s.begin(), s.end());
+        offsets.push_back((uint32_t)arena.size());
+    }
+    return true;
+}
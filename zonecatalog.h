@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "zonetable.h"
+using namespace std;
+
+// Minimal perfect hash over a fixed list of zone IDs (CHD: hash and
+// displace). Keys fall into buckets of about four; each bucket stores the
+// seed that sends all of its keys to free positions in 0..size()-1, so a
+// lookup is one hash, one seed load and one name compare, with no probing.
+class ZoneCatalog {
+public:
+    static const uint32_t kNone = UINT32_MAX;
+
+    // Duplicates are dropped; false if the list is empty.
+    bool build(vector<string> names);
+    // One zone ID per line; blank lines are skipped.
+    bool load(const string& path);
+
+    uint32_t find(std::string_view zone) const { return find(zone, hashZone(zone.data(), zone.size())); }
+    uint32_t find(std::string_view zone, uint64_t hash) const {
+        if (seeds.empty()) return kNone;
+        uint32_t pos = position(hash, seeds[bucket(hash)]);
+        return name(pos) == zone ? pos : kNone;
+    }
+    size_t size() const { return offsets.size() - 1; }
+    std::string_view name(uint32_t pos) const {
+        return std::string_view(arena.data() + offsets[pos], offsets[pos + 1] - offsets[pos]);
+    }
+
+private:
+    uint32_t bucket(uint64_t hash) const {
+        return uint32_t((((hash + salt) >> 32) * seeds.size()) >> 32);
+    }
+    uint32_t position(uint64_t hash, uint32_t seed) const {
+        uint64_t x = (hash + salt) ^ (uint64_t(seed) * 0x9e3779b97f4a7c15ULL);
+        x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return uint32_t(((x & 0xffffffffULL) * size()) >> 32);
+    }
+    bool place(const vector<string>& names, const vector<uint64_t>& hashes);
+
+    uint64_t salt = 0;
+    vector<uint32_t> seeds;          // per bucket
+    vector<uint32_t> offsets{0};     // name at position i is arena[offsets[i], offsets[i+1])
+    vector<char> arena;
+};
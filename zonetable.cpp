@@ -0,0 +1,163 @@
+#include "zonetable.h"
+#include "zonecatalog.h"
+#include <algorithm>
+using namespace std;
+
+void ZoneTable::rehash(size_t capacity) {
+    size_t cap = 16;
+    while (cap < capacity) cap <<= 1;
+    slots.assign(cap, Slot{0, 0});
+    mask = cap - 1;
+    for (uint32_t i = 0; i < hashes.size(); ++i) {
+        if (hashes[i] & (kDirect | kCatalog)) continue;
+        size_t pos = hashes[i] & mask;
+        while (slots[pos].ref) pos = (pos + 1) & mask;
+        slots[pos] = Slot{uint32_t(hashes[i] >> 32), i + 1};
+    }
+}
+
+void ZoneTable::reserve(size_t zones) {
+    if (zones * 2 > slots.size()) rehash(zones * 2);
+    hashes.reserve(zones);
+    offsets.reserve(zones + 1);
+    arena.reserve(zones * 16);
+}
+
+size_t ZoneTable::bytes() const {
+    return slots.capacity() * sizeof(Slot) + hashes.capacity() * sizeof(uint64_t)
+         + offsets.capacity() * sizeof(uint32_t) + arena.capacity() + direct.capacity() * sizeof(uint32_t);
+}
+
+void ZoneTable::clear() {
+    slots.clear();
+    mask = 0;
+    hashedZones = 0;
+    hashes.clear();
+    offsets.assign(1, 0);
+    arena.clear();
+    direct.clear();
+    schemeSet = false;
+    prefixLen = digits = 0;
+    if (zoneCatalog) {
+        for (uint32_t i = 0; i < zoneCatalog->size(); ++i) {
+            hashes.push_back(kCatalog);
+            append(zoneCatalog->name(i));
+        }
+    }
+}
+
+void ZoneTable::setCatalog(shared_ptr<const ZoneCatalog> catalog) {
+    zoneCatalog = std::move(catalog);
+    clear();
+}
+
+size_t ZoneTable::catalogZones() const {
+    return zoneCatalog ? zoneCatalog->size() : 0;
+}
+
+void ZoneTable::setHugePages(HugePagePolicy policy) {
+    slots = HugeVector<Slot>(HugePageAllocator<Slot>(policy));
+    hashes = HugeVector<uint64_t>(HugePageAllocator<uint64_t>(policy));
+    offsets = HugeVector<uint32_t>(1, 0, HugePageAllocator<uint32_t>(policy));
+    arena = HugeVector<char>(HugePageAllocator<char>(policy));
+    direct = HugeVector<uint32_t>(HugePageAllocator<uint32_t>(policy));
+    clear();
+}
+
+void ZoneTable::chooseScheme(std::string_view zone) {
+    schemeSet = true;
+    size_t p = zone.size();
+    while (p > 0 && zone[p - 1] >= '0' && zone[p - 1] <= '9') --p;
+    size_t width = zone.size() - p;
+    if (width < 1 || width > 9 || p > kMaxPrefix) return;
+    prefixLen = (uint8_t)p;
+    digits = (uint8_t)width;
+    memcpy(prefix, zone.data(), p);
+}
+
+uint64_t ZoneTable::probe(std::string_view zone) const {
+    uint64_t hash = 0;
+    if (zoneCatalog) {
+        hash = hashZone(zone.data(), zone.size());
+        uint32_t pos = zoneCatalog->find(zone, hash);
+        if (pos != ZoneCatalog::kNone) return kCatalog | pos;
+    }
+    if (digits && zone.size() == size_t(prefixLen) + digits &&
+        memcmp(zone.data(), prefix, prefixLen) == 0) {
+        const char* p = zone.data() + prefixLen;
+        uint64_t v = 0;
+        int i = 0;
+        for (; i < digits; ++i) {
+            unsigned d = (unsigned char)p[i] - '0';
+            if (d > 9) break;
+            v = v * 10 + d;
+        }
+        if (i == digits && v < kMaxDirect) {
+            if (v < direct.size()) __builtin_prefetch(&direct[v]);
+            return kDirect | v;
+        }
+    }
+    hash = hashKey(zoneCatalog ? hash : hashZone(zone.data(), zone.size()));
+    if (!slots.empty()) __builtin_prefetch(&slots[hash & mask]);
+    return hash;
+}
+
+uint32_t ZoneTable::append(std::string_view zone) {
+    uint32_t idx = (uint32_t)size();
+    arena.insert(arena.end(), zone.begin(), zone.end());
+    offsets.push_back((uint32_t)arena.size());
+    return idx;
+}
+
+uint32_t ZoneTable::find(std::string_view zone) const {
+    uint64_t key = probe(zone);
+    if (key & kCatalog) return uint32_t(key);
+    if (key & kDirect) {
+        uint64_t v = key & ~kDirect;
+        return v < direct.size() && direct[v] ? direct[v] - 1 : kNone;
+    }
+    if (slots.empty()) return kNone;
+    uint32_t tag = uint32_t(key >> 32);
+    for (size_t pos = key & mask; slots[pos].ref; pos = (pos + 1) & mask) {
+        const Slot& s = slots[pos];
+        if (s.tag == tag && name(s.ref - 1) == zone) return s.ref - 1;
+    }
+    return kNone;
+}
+
+uint32_t ZoneTable::findOrInsert(std::string_view zone, uint64_t key) {
+    if (key & kCatalog) return uint32_t(key);
+    if (key & kDirect) {
+        uint64_t v = key & ~kDirect;
+        if (v >= direct.size()) {
+            uint64_t limit = 1;
+            for (int i = 0; i < digits; ++i) limit *= 10;
+            uint64_t n = max<uint64_t>(direct.size() * 2, 1024);
+            while (n <= v) n <<= 1;
+            direct.resize(min(n, min(limit, kMaxDirect)), 0);
+        }
+        if (!direct[v]) {
+            hashes.push_back(kDirect);
+            direct[v] = append(zone) + 1;
+        }
+        return direct[v] - 1;
+    }
+
+    if ((hashedZones + 1) * 2 > slots.size()) rehash(max<size_t>(slots.size() * 2, 16));
+    uint32_t tag = uint32_t(key >> 32);
+    size_t pos = key & mask;
+    for (; slots[pos].ref; pos = (pos + 1) & mask) {
+        const Slot& s = slots[pos];
+        if (s.tag == tag && name(s.ref - 1) == zone) return s.ref - 1;
+    }
+    // Misses are rare, so this is where the scheme is fixed and where a
+    // key probed before the scheme existed is re-checked.
+    if (!schemeSet) chooseScheme(zone);
+    uint64_t again = probe(zone);
+    if (again & (kDirect | kCatalog)) return findOrInsert(zone, again);
+
+    hashes.push_back(key);
+    ++hashedZones;
+    slots[pos] = Slot{tag, append(zone) + 1};
+    return (uint32_t)size() - 1;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "hugepage.h"
+using namespace std;
+
+class ZoneCatalog;
+
+// Hash for zone IDs: 8 bytes per step, then a splitmix64 finalizer.
+inline uint64_t hashZone(const char* p, size_t n) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (n * 0xff51afd7ed558ccdULL);
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        h = (h ^ v) * 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 31;
+    }
+    uint64_t tail = 0;
+    for (size_t i = 0; i < n; ++i) tail |= uint64_t((unsigned char)p[i]) << (8 * i);
+    h = (h ^ tail) * 0x94d049bb133111ebULL;
+    h ^= h >> 29; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+// Zone dictionary: maps zone ID bytes to a dense index 0..size()-1 in
+// first-seen order. Names live in one arena and the table is open
+// addressing over (tag, index) pairs, so a lookup of a known zone never
+// allocates and inserts only allocate when a vector doubles.
+//
+// The first zone inserted also fixes a numeric scheme: its leading
+// non-digit bytes as prefix and its trailing digits as a fixed-width
+// suffix ("ZONE254" -> "ZONE" + 3 digits). IDs of exactly that shape are
+// looked up by suffix value in a flat array instead of being hashed; any
+// other ID (different prefix, case or width) takes the hashed path.
+//
+// With a catalog set, its zones occupy indices 0..catalog size-1 in
+// catalog order and are found through its perfect hash; only IDs outside
+// the catalog reach the paths above.
+class ZoneTable {
+public:
+    static const uint32_t kNone = UINT32_MAX;
+
+    // Lookup key for zone (catalog position, suffix value or hash), with
+    // its slot prefetched.
+    uint64_t probe(std::string_view zone) const;
+    static bool isCatalogKey(uint64_t key) { return (key & kCatalog) != 0; }
+    uint32_t findOrInsert(std::string_view zone) { return findOrInsert(zone, probe(zone)); }
+    uint32_t findOrInsert(std::string_view zone, uint64_t key);
+    uint32_t find(std::string_view zone) const;
+    std::string_view name(uint32_t idx) const {
+        return std::string_view(arena.data() + offsets[idx], offsets[idx + 1] - offsets[idx]);
+    }
+    size_t size() const { return offsets.size() - 1; }
+    size_t catalogZones() const;
+    size_t directZones() const { return size() - hashedZones - catalogZones(); }
+    void reserve(size_t zones);
+    size_t bytes() const;
+    void clear();
+    // Empties the table and backs its storage according to policy.
+    void setHugePages(HugePagePolicy policy);
+    // Empties the table and reseeds it with the catalog (null to drop it).
+    void setCatalog(shared_ptr<const ZoneCatalog> catalog);
+    const shared_ptr<const ZoneCatalog>& catalog() const { return zoneCatalog; }
+
+private:
+    static constexpr uint64_t kDirect = 1ULL << 63;          // key is a suffix value
+    static constexpr uint64_t kCatalog = 1ULL << 62;         // key is a catalog position
+    static constexpr uint64_t kMaxDirect = 1u << 22;         // larger suffixes are hashed
+    static constexpr size_t kMaxPrefix = 16;
+
+    struct Slot {
+        uint32_t tag;     // high half of the hash
+        uint32_t ref;     // zone index + 1, 0 = empty
+    };
+    static uint64_t hashKey(uint64_t hash) { return hash & ~(kDirect | kCatalog); }
+    void chooseScheme(std::string_view zone);
+    uint32_t append(std::string_view zone);
+    void rehash(size_t capacity);
+
+    HugeVector<Slot> slots;
+    size_t mask = 0;
+    size_t hashedZones = 0;
+    HugeVector<uint64_t> hashes;      // per zone, for rehashing; kDirect/kCatalog if not hashed
+    HugeVector<uint32_t> offsets{0};  // name i is arena[offsets[i], offsets[i+1])
+    HugeVector<char> arena;
+
+    HugeVector<uint32_t> direct;      // suffix value -> zone index + 1, 0 = unseen
+    bool schemeSet = false;
+    uint8_t prefixLen = 0;
+    uint8_t digits = 0;               // 0 = no numeric scheme
+    char prefix[kMaxPrefix];
+
+    shared_ptr<const ZoneCatalog> zoneCatalog;
+};